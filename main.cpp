@@ -10,35 +10,147 @@
 #include <atomic>
 #include <cstring>
 #include <algorithm>
+#include <numeric>
 #include <iostream>
 #include <chrono>
 #include <thread>
-typedef std::chrono::high_resolution_clock Clock;
+#include <deque>
+#include <map>
+#include <queue>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include <random>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <sched.h>
+#include <dirent.h>
+#include <csignal>
+#include <coroutine>
+#include <array>
+#include <sys/resource.h>
 
-// Structure to represent a fork with locking mechanisms
-struct Fork {
+// Clock of the event log timestamps and every interval measured in a run; high_resolution_clock may be the system
+// clock, which steps when the wall time is adjusted
+typedef std::chrono::steady_clock Clock;
+
+// Build with -DPHILO_STATS=1 to record per-philosopher and per-edge instrumentation
+#ifndef PHILO_STATS
+#define PHILO_STATS 0
+#endif
+
+// Size of a cache line, used to keep independently written state apart
+constexpr std::size_t CACHE_LINE = 64;
+
+// Bits of the packed edge word used by the atomic engine; a set bit places the item on side 1
+constexpr unsigned FORK_AT = 1u << 0;           // Side holding the fork
+constexpr unsigned FORK_TOKEN = 1u << 1;        // Side holding the fork request token
+constexpr unsigned FORK_DIRTY = 1u << 2;        // Fork is dirty
+constexpr unsigned BOTTLE_AT = 1u << 3;         // Side holding the bottle
+constexpr unsigned BOTTLE_TOKEN = 1u << 4;      // Side holding the bottle request token
+
+// Bounds of the spin before a philosopher parks: the fewest spins it probes with and the yields after spinning
+constexpr long SPIN_MIN = 16;
+constexpr int SPIN_YIELDS = 4;
+
+// Structure to represent a fork with locking mechanisms, as seen from both ends of its edge
+struct alignas(CACHE_LINE) Fork {
     std::mutex lock;                            // Mutex for locking critical sections
-    std::condition_variable condition_req_fork; // Condition variable for fork request
-    std::condition_variable condition_fork;     // Condition variable for fork availability
-    volatile bool hold;                         // Flag indicating if the fork is held by a philosopher
-    volatile bool reqf;                         // Flag indicating if a philosopher has requested the fork
-    volatile bool dirty = true;                 // Flag indicating if the fork is dirty (needs cleaning)
+    volatile bool hold[2] = {true, false};      // Flag indicating if the fork is held by a philosopher
+    volatile bool reqf[2] = {false, true};      // Flag indicating if a philosopher has requested the fork
+    volatile bool dirty[2] = {true, true};      // Flag indicating if the fork is dirty (needs cleaning)
+    std::atomic<unsigned> word{FORK_TOKEN | FORK_DIRTY | BOTTLE_TOKEN}; // Whole edge state for the atomic engine
 };
 
-// Structure to represent a bottle with locking mechanisms
-struct Bottle {
+// Structure to represent a bottle with locking mechanisms, as seen from both ends of its edge
+struct alignas(CACHE_LINE) Bottle {
     std::mutex lock;                            // Mutex for locking critical sections
-    std::condition_variable condition{};        // Condition variable for bottle availability
-    volatile bool hold;                         // Flag indicating if the bottle is held by a philosopher
-    volatile bool reqb;                         // Flag indicating if a philosopher has requested the bottle
+    volatile bool hold[2] = {true, false};      // Flag indicating if the bottle is held by a philosopher
+    volatile bool reqb[2] = {false, true};      // Flag indicating if a philosopher has requested the bottle
 };
 
-// Structure to represent the shared resources (forks and bottles)
+// Structure to represent the shared resources (fork and bottle) of one edge; side 0 is the
+// lower-numbered philosopher, which starts with both
 struct Resource {
     Fork fork;
     Bottle bottle;
 };
 
+// Structure to represent the conflict graph in compressed sparse row form
+struct Graph {
+    std::vector<long> offsets;                  // Edge slots of philosopher i are offsets[i] .. offsets[i + 1] - 1
+    std::vector<int> neighbor;                  // Philosopher at the other end of each edge slot
+    std::vector<long> reverse;                  // Slot of the same edge as seen from the neighbor
+    std::vector<long> edge;                     // Index of each edge slot's resource in the arena
+    std::vector<unsigned char> side;            // Side of the resource each edge slot owns
+    std::vector<Resource> arena;                // Contiguous, cache-line-aligned resources, one per edge
+    std::vector<long> spare;                    // Arena entries of removed edges, reused by later insertions
+};
+
+// Structure to represent one change to the conflict graph while the philosophers run
+struct GraphUpdate {
+    bool add;                                   // Insert rather than remove
+    int p;                                      // Philosopher, or one end of the edge
+    int q;                                      // Other end of the edge, -1 to change the philosopher itself
+};
+
+// Structure to represent the header of the binary graph format, followed by edge_cnt packed
+// pairs of 0-based uint32 philosopher ids
+struct GraphHeader {
+    char magic[4];                              // GRAPH_MAGIC
+    uint32_t version;                           // GRAPH_VERSION
+    uint32_t node_cnt;                          // Number of philosophers
+    uint32_t reserved;                          // Zero, keeps edge_cnt 8-byte aligned
+    uint64_t edge_cnt;                          // Number of edge pairs that follow
+};
+constexpr char GRAPH_MAGIC[4] = {'P', 'H', 'I', 'L'};
+constexpr uint32_t GRAPH_VERSION = 1;
+
+// Structure to represent the header of a checkpoint, followed by node_cnt CheckpointPhils, one 16-bit word of
+// CHECKPOINT_* flags per edge, one bit per edge slot for the bottles of the current session, and event_cnt
+// queued SimEvents of a discrete-event run
+struct CheckpointHeader {
+    char magic[4];                              // CHECKPOINT_MAGIC
+    uint32_t version;                           // CHECKPOINT_VERSION
+    uint32_t node_cnt;                          // Number of philosophers
+    uint32_t simulated;                         // Taken by the discrete-event engine
+    uint64_t edge_cnt;                          // Number of edges
+    uint64_t graph_hash;                        // FNV-1a hash of the adjacency the checkpoint belongs to
+    uint64_t sim_now;                           // Virtual time of a discrete-event run
+    uint64_t sim_seq;                           // Next event sequence number of a discrete-event run
+    uint64_t event_cnt;                         // Number of queued events that follow
+};
+constexpr char CHECKPOINT_MAGIC[4] = {'P', 'H', 'C', 'P'};
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+
+// Flags of an edge in a checkpoint, shifted left by the side they describe; both sides are kept because a
+// message of the discrete-event engine can be in flight with neither side holding the item
+constexpr unsigned CHECKPOINT_FORK = 1u << 0;           // Side holds the fork
+constexpr unsigned CHECKPOINT_FORK_TOKEN = 1u << 2;     // Side holds the fork request token
+constexpr unsigned CHECKPOINT_DIRTY = 1u << 4;          // Side sees the fork as dirty
+constexpr unsigned CHECKPOINT_BOTTLE = 1u << 6;         // Side holds the bottle
+constexpr unsigned CHECKPOINT_BOTTLE_TOKEN = 1u << 8;   // Side holds the bottle request token
+
+// Structure to represent one philosopher in a checkpoint
+struct CheckpointPhil {
+    uint32_t session;                           // Sessions completed
+    uint32_t seed;                              // rand_r state
+    uint32_t rest;                              // Length of the current tranquil or drinking period, microseconds
+    uint8_t dine;                               // Dine state
+    uint8_t drink;                              // Drink state
+    uint8_t resting;                            // Tranquil or drinking period in progress
+    uint8_t sched;                              // Scheduling state, used by the discrete-event engine
+};
+
 // Enum to represent the state of a philosopher's dining activity
 enum class Dine {
     THINKING = 1, HUNGRY, EATING
@@ -49,38 +161,634 @@ enum class Drink {
     TRANQUIL = 1, THIRSTY, DRINKING
 };
 
+// Enum to represent the kind of a logged event
+enum class Event : uint8_t {
+    THIRSTY = 1,    // Became thirsty
+    DRINKING,       // Started drinking
+    DRANK,          // Finished a drinking session
+    THINKING        // Went back to thinking
+};
+
+// Enum to represent the output format of the event log
+enum class LogFormat {
+    TEXT = 1,       // The human-readable drinking and thinking lines
+    BINARY,         // LOG_MAGIC followed by raw EventRecords
+    NONE
+};
+
+// Enum to represent the model that picks tranquil and drinking durations
+enum class Workload {
+    UNIFORM = 1,    // Uniform over the TRANQUIL and DRINKING ranges, slept
+    ZERO,           // No time at all, pure protocol throughput
+    SPIN,           // Busy-spin a calibrated number of iterations instead of sleeping
+    EXPONENTIAL,    // Exponential with workload_mean, slept
+    PARETO,         // Pareto with scale workload_mean and shape workload_alpha, slept
+    TRACE           // Per-philosopher durations replayed from a file
+};
+
+// Structure to represent one replayed session of a workload trace
+struct TraceRecord {
+    useconds_t tranquil;
+    useconds_t drinking;
+    std::vector<long> bottles;                  // Neighbors whose bottles the session needs, empty for the bottle mode
+};
+
+// Enum to represent how a thirsty philosopher picks the bottles of a session
+enum class Bottles {
+    ALL = 1,        // Every incident bottle, the dining philosophers special case
+    RANDOM,         // Each incident bottle independently with probability bottle_p
+    FIXED           // The neighbors configured per philosopher in a file, every bottle if not listed
+};
+
+// Structure to represent a fixed-size binary event record
+struct EventRecord {
+    uint64_t time;                              // Nanoseconds since the start of the run on the monotonic clock
+    uint32_t id;                                // Philosopher id, 0-based
+    uint32_t session;                           // Sessions completed when the event happened
+    Event type;
+    uint8_t reserved[7];                        // Zero, pads the record to 24 bytes
+};
+constexpr char LOG_MAGIC[4] = {'P', 'H', 'E', 'V'};
+
+// Structure to represent a single-producer single-consumer ring of event records owned by one thread
+struct EventRing {
+    static constexpr uint64_t SIZE = 1024;
+    alignas(CACHE_LINE) std::atomic<uint64_t> head{0};  // Next record written by the producing thread
+    alignas(CACHE_LINE) std::atomic<uint64_t> tail{0};  // Next record read by the writer thread
+    alignas(CACHE_LINE) EventRecord records[SIZE];
+};
+
+// Enum to represent the kinds of message sent between neighbors
+enum class Message {
+    FORK_REQUEST = 0, FORK, BOTTLE_REQUEST, BOTTLE,
+    FINISHED        // Transport control message: a philosopher completed its sessions, not counted
+};
+constexpr int MESSAGE_KINDS = 4;
+
+// Enum to represent how messages reach a philosopher in another partition
+enum class Transport {
+    DIRECT = 1,     // Shared memory, the sender updates the target's side of the edge itself
+    QUEUE,          // Batched through per-partition outboxes and delivered by a transport thread in-process
+    SOCKET          // Batched over Unix sockets between one process per partition
+};
+
+// Structure to represent a message crossing partitions
+struct Packet {
+    uint64_t lamport;                           // Lamport timestamp of the sending partition
+    uint64_t sent;                              // Nanoseconds on the system clock when the message was sent
+    uint32_t edge;                              // Edge slot at the sender, or the philosopher for FINISHED
+    Message type;
+};
+
+// Structure to represent the header of a batch of packets, followed by the sender's vector clock and the packets
+struct BatchHeader {
+    uint32_t src;                               // Sending partition
+    uint32_t dst;                               // Receiving partition
+    uint32_t count;                             // Packets in the batch
+    uint32_t reserved;                          // Zero
+};
+
+// Structure to represent an event of the discrete-event engine: a philosopher's step, or a message in flight
+struct SimEvent {
+    uint64_t time;                              // Virtual nanoseconds since the start of the run
+    uint64_t seq;                               // Order of scheduling, breaks ties between events at the same time
+    long id;                                    // Philosopher to step, or the sender of the message
+    long edge;                                  // Edge slot the message travels over at the sender, -1 for a step
+    Message type;
+
+    bool operator>(const SimEvent &other) const {
+        return time != other.time ? time > other.time : seq > other.seq;
+    }
+};
+
+// Number of log2-microsecond buckets in the instrumentation histograms
+constexpr int HIST_BUCKETS = 32;
+
+// Structure to represent the instrumentation of one philosopher; the thread stepping it writes it, and so does a
+// transport receiver counting the messages and locks of a message it applies on the philosopher's behalf
+struct alignas(CACHE_LINE) PhilStats {
+    std::atomic<uint64_t> steps{0};             // Steps taken
+    std::atomic<uint64_t> spurious{0};          // Steps (wakeups) that found nothing to do
+    std::atomic<uint64_t> thirsty_ns{0};        // Time from thirsty to drinking
+    std::atomic<uint64_t> hungry_ns{0};         // Time from hungry to eating
+    std::atomic<uint64_t> parked_ns{0};         // Time blocked waiting for a message
+    std::atomic<uint64_t> resting_ns{0};        // Time tranquil or drinking
+    std::atomic<uint64_t> lock_acquired{0};     // Resource locks taken
+    std::atomic<uint64_t> lock_contended{0};    // Resource locks that were already held
+    std::atomic<uint64_t> sent[MESSAGE_KINDS]{};        // Messages sent, by kind
+    std::atomic<uint64_t> wakeups{0};           // Wakeups delivered to the philosopher, written by its neighbors
+    std::atomic<uint64_t> thirsty_hist[HIST_BUCKETS]{}; // Thirsty-to-drinking times
+    std::atomic<uint64_t> hungry_hist[HIST_BUCKETS]{};  // Hungry-to-eating times
+    uint64_t thirsty_at = 0, hungry_at = 0, blocked_at = 0, resting_at = 0;
+};
+
+// Structure to represent the instrumentation of one edge; written by both of its philosophers
+struct EdgeStats {
+    std::atomic<uint64_t> lock_acquired{0};
+    std::atomic<uint64_t> lock_contended{0};
+    std::atomic<uint64_t> messages{0};
+};
+
+// Number of records a philosopher keeps for the report of a protocol violation
+constexpr int VERIFY_HISTORY = 16;
+
+// Enum to represent the kind of a verification history record: a state change, or a message to a neighbor
+enum class Verify : uint8_t {
+    HUNGRY = 1, EATING, THINKING, THIRSTY, DRINKING, DRANK,
+    FORK_REQUEST, FORK, BOTTLE_REQUEST, BOTTLE
+};
+
+// Structure to represent one record of a philosopher's verification history
+struct VerifyRecord {
+    uint64_t time;                              // Nanoseconds since the start of the run
+    long neighbor;                              // Receiver of a message, -1 for a state change
+    Verify kind;
+};
+
+// Structure to represent the verification state of one philosopher; only the thread stepping it writes it, and
+// the starvation watchdog reads thirsty_at
+struct alignas(CACHE_LINE) VerifyPhil {
+    uint64_t rng = 1;                           // xorshift state of the sampling, kept apart from rand_seeds
+    uint64_t skip = 0;                          // Steps left until the next checked one
+    uint64_t steps = 0;                         // Steps taken
+    uint64_t checks = 0;                        // Steps checked
+    uint64_t claims = 0;                        // Drinking sessions that claimed their bottles
+    std::atomic<uint64_t> thirsty_at{0};        // Run time it became thirsty plus one nanosecond, 0 when not thirsty
+    uint64_t next = 0;                          // Next history record written
+    VerifyRecord history[VERIFY_HISTORY]{};
+};
+
+// Enum to represent the engine used to hand forks and bottles between philosophers
+enum class Engine {
+    MUTEX = 1,      // Per-resource mutex around the flags of each side
+    ATOMIC          // One packed word per edge, transitioned with single atomic operations
+};
+
+// Enum to represent how philosophers are placed on cores
+enum class Placement {
+    NONE = 1,       // Input order, threads left to the OS scheduler
+    LABEL           // Label-propagation groups per NUMA node and core, renumbered and pinned
+};
+
+// Enum to represent the outcome of advancing a philosopher's state machine
+enum class Step {
+    BLOCKED = 1,    // Waiting for a fork or bottle message
+    SLEEPING,       // Tranquil or drinking for rest_time[id] microseconds
+    DONE            // Every philosopher has completed its sessions
+};
+
+// Enum to represent the scheduling state of a philosopher in the worker pool
+enum class Sched {
+    IDLE = 1, QUEUED, RUNNING, NOTIFIED, SLEEPING
+};
+
+// Structure to represent a value one thread writes while others may read it (the metrics scrape), through relaxed
+// loads and stores that compile to plain moves; a copy is a snapshot
+template <typename T>
+struct Relaxed {
+    std::atomic<T> value;
+
+    Relaxed(T initial = T()) : value(initial) {}
+    Relaxed(const Relaxed &other) : value(other.load()) {}
+    Relaxed &operator=(const Relaxed &other) {
+        return *this = other.load();
+    }
+    Relaxed &operator=(T next) {
+        value.store(next, std::memory_order_relaxed);
+        return *this;
+    }
+    operator T() const {
+        return load();
+    }
+    T load() const {
+        return value.load(std::memory_order_relaxed);
+    }
+    T operator++() {
+        T next = load() + 1;
+        value.store(next, std::memory_order_relaxed);
+        return next;
+    }
+};
+
+// Structure to represent a philosopher's wakeup signal
+struct Signal {
+    std::atomic<unsigned> epoch{0};             // Bumped on every message delivered to the philosopher
+    std::atomic<Sched> sched{Sched::IDLE};      // Scheduling state when running on the worker pool
+    std::atomic_bool pending{false};            // A batched wakeup was sent and the philosopher has not stepped since
+    std::atomic_bool stepping{false};           // Inside a step, which a pause waits for
+    std::atomic_bool parked{false};             // Asleep in the wait for a message, so a delivery must wake it
+    std::mutex lock;                            // Mutex guarding the condition variable
+    std::condition_variable condition;          // Condition variable for message arrival
+    long spin_budget = 0;                       // Spins that recently sufficed for a message to arrive
+    uint64_t spun = 0;                          // Waits ended while spinning
+    uint64_t yielded = 0;                       // Waits ended while yielding
+    uint64_t slept = 0;                         // Waits that parked
+};
+
+// Structure to represent a blocking start barrier
+struct Gate {
+    std::mutex lock;
+    std::condition_variable condition;
+    bool open = false;
+};
+
+// Structure to represent a worker's run queue and pending timers
+struct Worker {
+    std::mutex lock;
+    std::deque<long> ready;
+    std::priority_queue<std::pair<Clock::time_point, long>,
+                        std::vector<std::pair<Clock::time_point, long>>,
+                        std::greater<std::pair<Clock::time_point, long>>> timers;
+};
+
+// Structure to represent a pool of equally sized coroutine frames, carved from large blocks and recycled through
+// a free list; frames are only created and destroyed on the main thread, so it takes no lock
+struct FramePool {
+    static constexpr std::size_t BLOCK = 4096;  // Frames per block
+    std::size_t size = 0;                       // Bytes per frame, set by the first allocation
+    std::size_t used = BLOCK;                   // Frames handed out from the last block
+    std::vector<std::unique_ptr<char[]>> blocks;
+    void *free = nullptr;                       // Released frames, linked through their first word
+};
+
+// Structure to represent a philosopher running as a coroutine, resumed by the workers; its frame comes from the
+// frame pool and it starts suspended until first scheduled
+struct Task {
+    struct promise_type {
+        Task get_return_object() { return Task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+        static void *operator new(std::size_t size);
+        static void operator delete(void *frame, std::size_t size);
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+
+// Structure to represent a philosopher's coroutine waiting out a tranquil or drinking period on its worker's timers
+struct RestAwaiter {
+    long id;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle);
+    void await_resume() const noexcept {}
+};
+
+// Structure to represent a philosopher's coroutine waiting for the next message; it carries on at once if one
+// arrived during the step
+struct MessageAwaiter {
+    long id;
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle);
+    void await_resume() const noexcept {}
+};
+
+// Structure to represent the topology of the generic engine, read from the CSR arrays of the graph
+struct CsrTopology {
+    static long first(long id);
+    static long last(long id);
+    static long owner(long e);
+    static long neighbor(long e);
+    static long reverse(long e);
+    static long edge(long e);
+    static int side(long e);
+};
+
+// Structure to represent a ring of N philosophers with its edge slots computed at compile time, laid out the way
+// graph_build lays out ring:N: philosopher i has slots 2i towards i - 1 and 2i + 1 towards i + 1, except that
+// philosopher 0 lists N - 1 second and N - 1 lists 0 second
+template <long N>
+struct Ring {
+    static constexpr long NODES = N;
+    static constexpr long first(long id) { return 2 * id; }
+    static constexpr long last(long id) { return 2 * id + 2; }
+    static constexpr long owner(long e) { return e / 2; }
+    static constexpr long neighbor(long e) {
+        long i = e / 2, k = e % 2;
+        return i == 0 ? (k ? N - 1 : 1) : i == N - 1 ? (k ? 0 : N - 2) : (k ? i + 1 : i - 1);
+    }
+    static constexpr long edge(long e) {
+        long i = e / 2, k = e % 2;
+        return i == 0 ? (k ? N - 1 : 0) : i == N - 1 ? (k ? N - 1 : N - 2) : (k ? i : i - 1);
+    }
+    static constexpr long reverse(long e) {
+        long i = e / 2, j = neighbor(e);
+        return 2 * j + (j == 0 ? i != 1 : i != j - 1);
+    }
+    static constexpr int side(long e) { return e / 2 < neighbor(e) ? 0 : 1; }
+};
+
+// Structure to represent a clique of N philosophers with its edge slots computed at compile time, laid out the way
+// graph_build lays out complete:N: philosopher i lists every other philosopher in order, and edges are numbered
+// pair by pair in the same order
+template <long N>
+struct Clique {
+    static constexpr long NODES = N;
+    static constexpr long first(long id) { return id * (N - 1); }
+    static constexpr long last(long id) { return (id + 1) * (N - 1); }
+    static constexpr long owner(long e) { return e / (N - 1); }
+    static constexpr long neighbor(long e) {
+        long i = e / (N - 1), k = e % (N - 1);
+        return k < i ? k : k + 1;
+    }
+    static constexpr long edge(long e) {
+        long a = std::min(e / (N - 1), neighbor(e)), b = std::max(e / (N - 1), neighbor(e));
+        return a * (N - 1) - a * (a - 1) / 2 + b - a - 1;
+    }
+    static constexpr long reverse(long e) {
+        long i = e / (N - 1), j = neighbor(e);
+        return first(j) + (i < j ? i : i - 1);
+    }
+    static constexpr int side(long e) { return e / (N - 1) < neighbor(e) ? 0 : 1; }
+};
+
+// Structure to represent one edge slot of a compiled-in topology
+struct FixedSlot {
+    int neighbor;                               // Philosopher at the other end
+    int edge;                                   // Resource in the arena
+    int reverse;                                // Slot of the other end
+    int side;                                   // Side of the resource this end owns
+};
+
+// Structure to represent a ring or clique with its slots laid out in one array at compile time, so the engine
+// finds everything about a slot in a single entry at a fixed address instead of four vectors reached through
+// the graph
+template <typename Shape>
+struct Fixed {
+    static constexpr long SLOTS = Shape::last(Shape::NODES - 1);
+    static constexpr std::array<FixedSlot, SLOTS> TABLE = [] {
+        std::array<FixedSlot, SLOTS> table{};
+        for (long e = 0; e < SLOTS; e++) {
+            table[e] = {static_cast<int>(Shape::neighbor(e)), static_cast<int>(Shape::edge(e)),
+                        static_cast<int>(Shape::reverse(e)), Shape::side(e)};
+        }
+        return table;
+    }();
+    static constexpr long first(long id) { return Shape::first(id); }
+    static constexpr long last(long id) { return Shape::last(id); }
+    static constexpr long owner(long e) { return Shape::owner(e); }
+    static constexpr long neighbor(long e) { return TABLE[e].neighbor; }
+    static constexpr long reverse(long e) { return TABLE[e].reverse; }
+    static constexpr long edge(long e) { return TABLE[e].edge; }
+    static constexpr int side(long e) { return TABLE[e].side; }
+};
+
+// Structure to represent a topology with a compiled-in engine
+struct FixedTopology {
+    const char *spec;                           // Graph spec it was compiled for
+    bool (*matches)();                          // Whether the graph is laid out exactly like it
+    Step (*step)(long id);                      // philosopher_step specialized for it
+};
+
 // Function declarations
 void *philosopher(void *pid);
-void tranquil(long id);
-void drink(long id);
-void send_fork_request(long from, long to);
-void send_fork(long from, long to);
-void send_bottle_request(long from, long to);
-void send_bottle(long from, long to);
+Task philosopher_coroutine(long id);
+void *worker(void *wid);
+Step philosopher_step(long id);
+template <typename Topology> Step philosopher_step_on(long id);
+template <typename Topology> bool topology_matches();
+useconds_t tranquil(long id);
+useconds_t drink(long id);
+void workload_initialize(const std::string &spec);
+useconds_t workload_duration(long id, bool drinking);
+void spin(uint64_t iterations);
+void finish();
+bool transport_remote(long from, long to);
+void transport_send(long from, long edge, Message type);
+void transport_finished(long id);
+void transport_fork();
+void transport_deliver(const BatchHeader &header, const uint64_t *clock, const Packet *packets);
+void *transport_sender(void *);
+void *transport_receiver(void *);
+void transport_report(double seconds);
+Clock::time_point clock_now();
+void sim_push(const SimEvent &event);
+bool sim_pop(SimEvent &event);
+void sim_send(long from, long edge, Message type);
+void sim_wake(long id);
+void sim_run();
+uint64_t checkpoint_hash();
+unsigned checkpoint_edge(long r);
+void checkpoint_capture(std::vector<char> &out);
+void checkpoint_write(const std::vector<char> &data);
+void checkpoint_take(bool stopping = false);
+void checkpoint_poll();
+void *checkpointer(void *);
+void checkpoint_interrupt(int);
+void checkpoint_load(const std::string &file);
+void pause_all();
+void pause_release();
+Step pause_step(long id);
+bool verify_sample(long id);
+void verify_step(long id);
+void verify_record(long id, Verify kind, long neighbor = -1);
+void verify_message(long from, long edge, Message type);
+void verify_claim(long id);
+void verify_unclaim(long id);
+void verify_watch();
+void verify_fail(long id, long edge, const std::string &what);
+void *verifier(void *);
+void verify_graphs(long count);
+void bottles_initialize(const std::string &spec);
+void bottles_resolve(long id, const std::vector<long> &list, char *mask);
+void bottles_choose(long id);
+template <typename Topology = CsrTopology> void send_fork_request(long from, long edge);
+template <typename Topology = CsrTopology> void send_fork(long from, long edge);
+template <typename Topology = CsrTopology> void send_bottle_request(long from, long edge);
+template <typename Topology = CsrTopology> void send_bottle(long from, long edge);
+template <typename Topology = CsrTopology> bool holds_fork(long edge);
+template <typename Topology = CsrTopology> bool holds_bottle(long edge);
+template <typename Topology = CsrTopology> void dirty_fork(long edge);
+void spin_pause();
+void wait_message(long id, unsigned seen);
+void wake(long id);
+void notify(long id);
+void notify_flush();
+void wake_all();
+void schedule(long id);
+void gate_wait(Gate &gate);
+void log_event(long id, Event type);
+void resource_lock(std::mutex &lock, long id, long edge);
+void resource_unlock(std::mutex &lock);
+void stats_message(long from, long edge, Message type);
+void stats_count(std::atomic<uint64_t> &counter);
+void stats_start(uint64_t &since);
+void stats_stop(uint64_t &since, std::atomic<uint64_t> &total, std::atomic<uint64_t> *hist = nullptr);
+void stats_report();
+void *stats_sampler(void *);
+void metrics_write(std::ostream &out, long sessions_done, double rate);
+void *metrics_server(void *);
+void *log_writer(void *);
+void gate_open(Gate &gate);
 
 // Main function for parsing command line arguments
 int parser(int argc, char **argv);
 
 // Function to initialize the dining graph
-std::vector<std::vector<std::pair<int, Resource*>>> graph_initialize(int mode);
+Graph graph_initialize(int mode);
+Graph graph_build(int n, const uint32_t *pairs, long m);
+Graph graph_load(const std::string &file);
+void graph_save(const std::string &file);
+Graph graph_complete(int n);
+Graph graph_generate(const std::string &spec);
+void graph_update(const std::vector<GraphUpdate> &updates);
+bool graph_yields(long p, long q);
+void resource_reset(Resource &resource);
+void resource_copy(Resource &to, const Resource &from);
+void *control_reader(void *);
+void place();
+void place_split(const Graph &g, const std::vector<int> &members, const std::vector<long> &target, std::vector<int> &group);
+void place_topology(std::vector<int> &cpus, std::vector<int> &nodes);
+void place_pin(long group);
+long place_original(long id);
+long place_renamed(long id);
+void bench_graph();
+void bench(const std::string &specs);
+void simulate();
 
 // Constants for time intervals
 constexpr long TRANQUIL_MIN = 1, TRANQUIL_MAX = 1000;  
 constexpr long DRINKING_MIN = 1, DRINKING_MAX = 1000; 
 constexpr long TRANQUIL_RANGE = TRANQUIL_MAX - TRANQUIL_MIN;
 constexpr long DRINKING_RANGE = DRINKING_MAX - DRINKING_MIN;
+constexpr double WORKLOAD_MAX = 1000000;
 
 // Global variables
 bool debug = false;
+bool bench_lookup = false;
+bool measure = false;
+std::string bench_spec;
+std::string bench_format = "csv";
+std::string graph_spec;
 int p_cnt;
 int count_session = 20;
+int workers = 0;
+bool batch = false;
+bool coroutines = false;
+bool fixed = false;
+long spin_max = 1024;
+Step (*stepper)(long id) = philosopher_step_on<CsrTopology>;
+const FixedTopology FIXED_TOPOLOGIES[] = {
+        {"ring:5", topology_matches<Fixed<Ring<5>>>, philosopher_step_on<Fixed<Ring<5>>>},
+        {"ring:64", topology_matches<Fixed<Ring<64>>>, philosopher_step_on<Fixed<Ring<64>>>},
+        {"ring:1024", topology_matches<Fixed<Ring<1024>>>, philosopher_step_on<Fixed<Ring<1024>>>},
+        {"complete:5", topology_matches<Fixed<Clique<5>>>, philosopher_step_on<Fixed<Clique<5>>>},
+        {"complete:16", topology_matches<Fixed<Clique<16>>>, philosopher_step_on<Fixed<Clique<16>>>},
+        {"complete:64", topology_matches<Fixed<Clique<64>>>, philosopher_step_on<Fixed<Clique<64>>>},
+};
+FramePool frame_pool;
+std::vector<std::coroutine_handle<>> frames;
+Engine engine = Engine::MUTEX;
 std::string path;
-std::atomic_bool start;
-std::vector<Dine> dineState;
-std::vector<Drink> drinkState;
-std::vector<std::vector<std::pair<int, Resource*>>> graph;
+std::string convert_path;
+Gate start;
+std::vector<Relaxed<Dine>> dineState;
+std::vector<Relaxed<Drink>> drinkState;
+Graph graph;
 std::vector<unsigned int> rand_seeds;
-std::mutex print_lock;
+std::vector<Relaxed<int>> sessions;
+std::vector<useconds_t> rest_time;
+std::vector<char> resting;
+std::unique_ptr<Signal[]> signals;
+std::unique_ptr<Worker[]> pool;
+std::atomic<long> finished_cnt;
+std::atomic<long> queued_cnt;
+std::atomic<long> pool_next;
+long pool_sleepers = 0;
+std::mutex pool_lock;
+std::condition_variable pool_condition;
+thread_local long worker_id = -1;
+thread_local bool batch_deferring = false;
+thread_local std::vector<long> batch_targets;
+LogFormat log_format = LogFormat::TEXT;
+Clock::time_point run_start;
+std::vector<std::unique_ptr<EventRing>> log_rings;
+std::mutex log_lock;
+std::atomic_bool log_stop;
+pthread_t log_thread;
+thread_local EventRing *log_ring = nullptr;
+std::vector<Clock::time_point> thirsty_since;
+std::unique_ptr<PhilStats[]> phil_stats;
+std::unique_ptr<EdgeStats[]> edge_stats;
+std::string stats_path;
+long stats_interval = 0;
+std::string metrics_path;
+long metrics_top = 10;
+std::vector<std::vector<uint64_t>> latencies;
+Workload workload = Workload::UNIFORM;
+std::string workload_spec;
+double workload_mean = 0;
+double workload_alpha = 0;
+uint64_t spin_iterations = 0;
+std::vector<std::vector<TraceRecord>> workload_trace;
+Bottles bottle_mode = Bottles::ALL;
+double bottle_p = 1;
+std::vector<std::pair<long, std::vector<long>>> bottle_config;
+std::vector<char> bottle_fixed;
+std::vector<char> wanted;
+std::vector<Clock::time_point> drinking_since;
+std::atomic<long> drinking_cnt;
+std::atomic<long> drinking_max;
+std::atomic<uint64_t> drinking_ns;
+std::atomic<uint64_t> wanted_cnt;
+Transport transport = Transport::DIRECT;
+int partitions = 1;
+int partition = 0;
+std::vector<int> owner;
+std::vector<int> peer_fds;
+std::vector<pid_t> children;
+std::vector<std::vector<Packet>> outbox;
+std::mutex transport_lock;
+std::condition_variable transport_condition;
+std::atomic_bool transport_stop;
+std::vector<std::vector<uint64_t>> vclocks;
+std::unique_ptr<std::atomic<uint64_t>[]> lamport;
+std::atomic<uint64_t> transport_sent;
+std::atomic<uint64_t> transport_received;
+std::atomic<uint64_t> transport_batches;
+std::atomic<uint64_t> transport_reordered;
+std::vector<uint64_t> transport_latency;
+thread_local bool transport_delivering = false;
+bool simulating = false;
+double sim_latency = 0;
+long seed = -1;
+uint64_t sim_now = 0;
+uint64_t sim_seq = 0;
+uint64_t sim_count = 0;
+bool sim_delivering = false;
+bool sim_restored = false;
+long resumed_sessions = 0;
+std::string checkpoint_path;
+std::string resume_path;
+long checkpoint_interval = 60000;
+Clock::time_point checkpoint_next;
+volatile sig_atomic_t checkpoint_signal = 0;
+bool pausing = false;
+std::atomic_bool pause_requested;
+std::mutex pause_lock;
+std::condition_variable pause_condition;
+bool dynamic = false;
+std::string control_path;
+int capacity = 0;
+std::vector<Relaxed<char>> present;
+std::vector<uint64_t> meals;
+bool verifying = false;
+double verify_rate = 1;
+long verify_starve = 10000;
+long verify_count = 0;
+std::string verify_context;
+std::unique_ptr<VerifyPhil[]> verify_phils;
+std::unique_ptr<std::atomic<long>[]> verify_claims;
+std::mutex verify_lock;
+std::mutex layout_lock;
+std::priority_queue<SimEvent, std::vector<SimEvent>, std::greater<SimEvent>> sim_events;
+std::deque<SimEvent> sim_current;
+std::deque<SimEvent> sim_flight;
+Placement placement = Placement::NONE;
+std::vector<int> placed_from;
+std::vector<int> placed_to;
+std::vector<int> place_group;
+std::vector<int> place_cpu;
 
 
 // Function to parse command line arguments
@@ -91,11 +799,40 @@ int parser(int argc, char **argv) {
     static struct option opts[] = {
             {"session",  required_argument, nullptr, 's'},
             {"filename", required_argument, nullptr, 'f'},
+            {"workers",  required_argument, nullptr, 'w'},
+            {"engine",   required_argument, nullptr, 'e'},
+            {"bench-graph", no_argument,    nullptr, 'B'},
+            {"convert",  required_argument, nullptr, 'c'},
+            {"log",      required_argument, nullptr, 'l'},
+            {"graph",    required_argument, nullptr, 'g'},
+            {"bench",    required_argument, nullptr, 'b'},
+            {"bench-format", required_argument, nullptr, 'F'},
+            {"stats",    required_argument, nullptr, 'S'},
+            {"stats-interval", required_argument, nullptr, 'I'},
+            {"workload", required_argument, nullptr, 'W'},
+            {"bottles",  required_argument, nullptr, 'D'},
+            {"partitions", required_argument, nullptr, 'P'},
+            {"transport", required_argument, nullptr, 'T'},
+            {"place",    required_argument, nullptr, 'A'},
+            {"batch",    no_argument,       nullptr, 'M'},
+            {"sim",      required_argument, nullptr, 'Z'},
+            {"seed",     required_argument, nullptr, 'R'},
+            {"checkpoint", required_argument, nullptr, 'K'},
+            {"checkpoint-interval", required_argument, nullptr, 'J'},
+            {"resume",   required_argument, nullptr, 'U'},
+            {"control",  required_argument, nullptr, 'C'},
+            {"capacity", required_argument, nullptr, 'N'},
+            {"verify",   required_argument, nullptr, 'V'},
+            {"coroutines", no_argument,     nullptr, 'O'},
+            {"fixed",    no_argument,       nullptr, 'H'},
+            {"verify-graphs", required_argument, nullptr, 'X'},
+            {"metrics",  required_argument, nullptr, 'm'},
+            {"spin",     required_argument, nullptr, 'Y'},
             {nullptr,    no_argument,       nullptr, 0},
     };
 
     // Loop through command line options using getopt_long
-    while ((opt = getopt_long(argc, argv, ":s:f:-d", opts, nullptr)) != EOF) {
+    while ((opt = getopt_long(argc, argv, ":s:f:w:e:Bc:l:g:b:F:S:I:W:D:P:T:A:MZ:R:K:J:U:C:N:V:X:OHm:Y:-d", opts, nullptr)) != EOF) {
         switch (opt) {
             // Case for handling the 'session' option
             case 's':
@@ -107,6 +844,216 @@ int parser(int argc, char **argv) {
                 path = optarg;
                 break;
 
+            // Case for handling the 'workers' option
+            case 'w':
+                workers = static_cast<int>(std::strtol(optarg, nullptr, 10));
+                break;
+
+            // Case for handling the 'engine' option
+            case 'e':
+                if (!strcmp(optarg, "mutex")) {
+                    engine = Engine::MUTEX;
+                } else if (!strcmp(optarg, "atomic")) {
+                    engine = Engine::ATOMIC;
+                } else {
+                    std::cerr << "ERROR: unknown engine '" << optarg << "'" << std::endl;
+                    exit(-1);
+                }
+                break;
+
+            // Case for handling the 'bench-graph' option
+            case 'B':
+                bench_lookup = true;
+                break;
+
+            // Case for handling the 'convert' option
+            case 'c':
+                convert_path = optarg;
+                break;
+
+            // Case for handling the 'log' option
+            case 'l':
+                if (!strcmp(optarg, "text")) {
+                    log_format = LogFormat::TEXT;
+                } else if (!strcmp(optarg, "binary")) {
+                    log_format = LogFormat::BINARY;
+                } else if (!strcmp(optarg, "none")) {
+                    log_format = LogFormat::NONE;
+                } else {
+                    std::cerr << "ERROR: unknown log format '" << optarg << "'" << std::endl;
+                    exit(-1);
+                }
+                break;
+
+            // Case for handling the 'graph' option
+            case 'g':
+                graph_spec = optarg;
+                break;
+
+            // Case for handling the 'bench' option
+            case 'b':
+                bench_spec = optarg;
+                break;
+
+            // Case for handling the 'bench-format' option
+            case 'F':
+                bench_format = optarg;
+                break;
+
+            // Case for handling the 'stats' and 'stats-interval' options
+            case 'S':
+            case 'I':
+                if (!PHILO_STATS) {
+                    std::cerr << "WARN: instrumentation is disabled, rebuild with -DPHILO_STATS=1" << std::endl;
+                } else if (opt == 'S') {
+                    stats_path = optarg;
+                } else {
+                    stats_interval = std::strtol(optarg, nullptr, 10);
+                }
+                break;
+
+            // Case for handling the 'workload' option
+            case 'W':
+                workload_spec = optarg;
+                break;
+
+            // Case for handling the 'bottles' option
+            case 'D':
+                bottles_initialize(optarg);
+                break;
+
+            // Case for handling the 'partitions' option, which runs over sockets unless a transport is given
+            case 'P':
+                partitions = static_cast<int>(std::strtol(optarg, nullptr, 10));
+                if (partitions > 1 && transport == Transport::DIRECT) {
+                    transport = Transport::SOCKET;
+                }
+                break;
+
+            // Case for handling the 'transport' option
+            case 'T':
+                if (!strcmp(optarg, "direct")) {
+                    transport = Transport::DIRECT;
+                } else if (!strcmp(optarg, "queue")) {
+                    transport = Transport::QUEUE;
+                } else if (!strcmp(optarg, "socket")) {
+                    transport = Transport::SOCKET;
+                } else {
+                    std::cerr << "ERROR: unknown transport '" << optarg << "'" << std::endl;
+                    exit(-1);
+                }
+                break;
+
+            // Case for handling the 'place' option
+            case 'A':
+                if (!strcmp(optarg, "none")) {
+                    placement = Placement::NONE;
+                } else if (!strcmp(optarg, "label")) {
+                    placement = Placement::LABEL;
+                } else {
+                    std::cerr << "ERROR: unknown placement '" << optarg << "'" << std::endl;
+                    exit(-1);
+                }
+                break;
+
+            // Case for handling the 'batch' option
+            case 'M':
+                batch = true;
+                break;
+
+            // Case for handling the 'sim' option, the virtual latency of every message in microseconds
+            case 'Z':
+                simulating = true;
+                sim_latency = std::strtod(optarg, nullptr);
+                if (sim_latency < 0) {
+                    std::cerr << "ERROR: invalid message latency '" << optarg << "'" << std::endl;
+                    exit(-1);
+                }
+                break;
+
+            // Case for handling the 'seed' option
+            case 'R':
+                seed = std::strtol(optarg, nullptr, 10);
+                break;
+
+            // Case for handling the 'checkpoint', 'checkpoint-interval' and 'resume' options
+            case 'K':
+                checkpoint_path = optarg;
+                break;
+            case 'J':
+                checkpoint_interval = std::strtol(optarg, nullptr, 10);
+                break;
+            case 'U':
+                resume_path = optarg;
+                break;
+
+            // Case for handling the 'control' option, a file or FIFO of graph updates applied while running
+            case 'C':
+                control_path = optarg;
+                dynamic = true;
+                break;
+
+            // Case for handling the 'capacity' option, the number of philosophers graph updates may use
+            case 'N':
+                capacity = static_cast<int>(std::strtol(optarg, nullptr, 10));
+                break;
+
+            // Case for handling the 'verify' option, the fraction of steps checked and optionally the time in
+            // milliseconds a philosopher may stay thirsty before it counts as starving
+            case 'V': {
+                char *end;
+                verifying = true;
+                verify_rate = std::strtod(optarg, &end);
+                if (*end == ':') {
+                    verify_starve = std::strtol(end + 1, &end, 10);
+                }
+                if (*end || verify_rate <= 0 || verify_rate > 1 || verify_starve <= 0) {
+                    std::cerr << "ERROR: invalid verification '" << optarg << "', give <rate>[:<ms>] with 0 < rate <= 1" << std::endl;
+                    exit(-1);
+                }
+                break;
+            }
+
+            // Case for handling the 'verify-graphs' option
+            case 'X':
+                verify_count = std::strtol(optarg, nullptr, 10);
+                break;
+
+            // Case for handling the 'coroutines' option
+            case 'O':
+                coroutines = true;
+                break;
+
+            // Case for handling the 'metrics' option, a socket path with an optional count of edges to list
+            case 'm': {
+                metrics_path = optarg;
+                size_t colon = metrics_path.rfind(':');
+                if (colon != std::string::npos) {
+                    char *end;
+                    metrics_top = std::strtol(metrics_path.c_str() + colon + 1, &end, 10);
+                    if (*end || metrics_top < 0) {
+                        std::cerr << "ERROR: invalid metrics '" << optarg << "', give <path>[:<edges>]" << std::endl;
+                        exit(-1);
+                    }
+                    metrics_path.resize(colon);
+                }
+                break;
+            }
+
+            // Case for handling the 'spin' option
+            case 'Y':
+                spin_max = std::strtol(optarg, nullptr, 10);
+                if (spin_max < 0) {
+                    std::cerr << "ERROR: invalid spin limit '" << optarg << "'" << std::endl;
+                    exit(-1);
+                }
+                break;
+
+            // Case for handling the 'fixed' option
+            case 'H':
+                fixed = true;
+                break;
+
             // Case for handling the 'debug' option
             case 'd':
                 debug = true;
@@ -119,13 +1066,20 @@ int parser(int argc, char **argv) {
 
             // Case for handling an unknown option
             case '?':
-                std::cout << "USAGE: philosophers -s <session_count> -f <filename> [-]" << std::endl;
+                std::cout << "USAGE: philosophers -s <session_count> -f <filename> [-w <workers>] [-e mutex|atomic] [-l text|binary|none] [-g <spec>] [-W <workload>] [-D all|random:<p>|fixed:<file>] [-P <partitions> [-T direct|queue|socket]] [-A none|label] [-M] [-O] [-H] [-m <socket>[:<edges>]] [-Y <spins>] [-Z <latency_us>] [-R <seed>] [-K <checkpoint> [-J <ms>]] [-U <checkpoint>] [-C <control> [-N <philosophers>]] [-V <rate>[:<ms>]] [-X <graphs>] [-b <spec,...> [-F csv|json]] [-]" << std::endl;
                 exit(-1);
             default:
                 break;
         }
     }
 
+    // Coroutines run on one worker per CPU unless the number of workers is given
+    if (coroutines && workers <= 0) {
+        cpu_set_t set;
+        sched_getaffinity(0, sizeof(set), &set);
+        workers = CPU_COUNT(&set);
+    }
+
     // If debug mode is enabled, print the session count
     if (debug) {
         std::cout << "SESSIONS COUNT:   " << (count_session = count_session < 1 ? 20 : count_session) << std::endl;
@@ -133,8 +1087,10 @@ int parser(int argc, char **argv) {
 
     // Check for any remaining arguments after processing options
     for (; optind < argc; optind++) {
-        // If a hyphen is encountered, return 2 indicating a special case
+        // A hyphen reads the graph as updates from stdin, which stays open as the control channel
         if (!strcmp(argv[optind], "-")) {
+            control_path = "-";
+            dynamic = true;
             return 2;
         }
     }
@@ -151,353 +1107,3929 @@ int parser(int argc, char **argv) {
     return 0;
 }
 
-// Function to initialize the dining graph based on the selected mode
-std::vector<std::vector<std::pair<int, Resource*>>> graph_initialize(int mode) {
-    // Mode 1: Read graph from file
-    if (mode == 1) {
-        std::ifstream file(path);
-        if (file.good()) {
-            int p1, p2, n = 0;
-            
-            // Read the number of philosophers from the file
-            file >> p_cnt;
-            
-            // Initialize the graph vector
-            std::vector<std::vector<std::pair<int, Resource*>>> graph(static_cast<unsigned long>(p_cnt));
-            
-            // Read edge pairs from the file and create resources for forks and bottles
-            for (int i = 0; i < p_cnt; i++) {
-                file >> p1 >> p2;
-                
-                // Validate edge pairs
-                if (p1 < 1 || p2 < 1 || p1 > p_cnt || p2 > p_cnt) {
-                    std::cerr << "ERROR: invalid graph" << std::endl;
-                    exit(-1);
-                }
+// Function to build the compressed sparse row graph from m packed pairs of 0-based philosopher ids,
+// validating ranges, self-loops and duplicate edges on the way
+Graph graph_build(int n, const uint32_t *pairs, long m) {
+    Graph g;
+    g.offsets.assign(static_cast<unsigned long>(n) + 1, 0);
+    g.neighbor.resize(2 * static_cast<unsigned long>(m));
+    g.reverse.resize(2 * static_cast<unsigned long>(m));
+    g.edge.resize(2 * static_cast<unsigned long>(m));
+    g.side.resize(2 * static_cast<unsigned long>(m));
 
-                // Create positive and negative resources for forks and bottles
-                Resource *pos = new Resource, *neg = new Resource;
-                pos->fork.hold = pos->bottle.hold = true;
-                neg->fork.reqf = neg->bottle.reqb = true;
+    // Allocate the resources of every edge from one contiguous arena
+    std::vector<Resource>(static_cast<unsigned long>(m)).swap(g.arena);
 
-                // Add the edge pairs to the graph
-                graph[p1 - 1].push_back(std::make_pair(p2 - 1, p1 < p2 ? pos : neg));
-                graph[p2 - 1].push_back(std::make_pair(p1 - 1, p1 < p2 ? neg : pos));
+    // Count the degree of every philosopher and turn the counts into slot offsets
+    for (long i = 0; i < m; i++) {
+        uint32_t p1 = pairs[2 * i], p2 = pairs[2 * i + 1];
+        if (p1 >= static_cast<uint32_t>(n) || p2 >= static_cast<uint32_t>(n) || p1 == p2) {
+            std::cerr << "ERROR: invalid graph: edge " << p1 + 1 << " " << p2 + 1 << std::endl;
+            exit(-1);
+        }
+        g.offsets[p1 + 1]++;
+        g.offsets[p2 + 1]++;
+    }
+    for (int i = 0; i < n; i++) {
+        g.offsets[i + 1] += g.offsets[i];
+    }
 
-                n++;
-            }
+    // Fill both slots of every edge and link each slot to its reverse
+    std::vector<long> next(g.offsets.begin(), g.offsets.end() - 1);
+    for (long i = 0; i < m; i++) {
+        int p1 = static_cast<int>(pairs[2 * i]), p2 = static_cast<int>(pairs[2 * i + 1]);
+        long s1 = next[p1]++, s2 = next[p2]++;
 
-            // Validate the number of edges in the graph
-            if (n < p_cnt - 1 || n > (p_cnt * (p_cnt - 1) / 2)) {
-                std::cerr << "ERROR: invalid graph" << std::endl;
+        // The lower-numbered philosopher owns side 0 and starts with the fork and the bottle
+        g.neighbor[s1] = p2;
+        g.neighbor[s2] = p1;
+        g.reverse[s1] = s2;
+        g.reverse[s2] = s1;
+        g.edge[s1] = g.edge[s2] = i;
+        g.side[s1] = p1 < p2 ? 0 : 1;
+        g.side[s2] = p1 < p2 ? 1 : 0;
+    }
+
+    // Reject duplicate edges by marking each philosopher's neighbors
+    std::vector<int> mark(static_cast<unsigned long>(n), -1);
+    for (int i = 0; i < n; i++) {
+        for (long e = g.offsets[i]; e < g.offsets[i + 1]; e++) {
+            if (mark[g.neighbor[e]] == i) {
+                std::cerr << "ERROR: invalid graph: duplicate edge " << i + 1 << " " << g.neighbor[e] + 1 << std::endl;
                 exit(-1);
             }
+            mark[g.neighbor[e]] = i;
+        }
+    }
+    return g;
+}
 
-            return graph;
-        } else {
-            std::cerr << "ERROR: file '" << path << "' not found" << std::endl;
+// Function to parse an unsigned decimal number from a text buffer, skipping leading whitespace
+bool parse_number(const char *&cursor, const char *end, uint64_t &value) {
+    while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\n' || *cursor == '\r')) {
+        cursor++;
+    }
+    if (cursor == end) {
+        return false;
+    }
+    if (*cursor < '0' || *cursor > '9') {
+        std::cerr << "ERROR: invalid graph: unexpected '" << *cursor << "'" << std::endl;
+        exit(-1);
+    }
+    value = 0;
+    while (cursor < end && *cursor >= '0' && *cursor <= '9') {
+        value = value * 10 + static_cast<uint64_t>(*cursor++ - '0');
+        if (value > UINT32_MAX) {
+            std::cerr << "ERROR: invalid graph: number out of range" << std::endl;
             exit(-1);
         }
+    }
+    return true;
+}
 
-    // Mode 2: Manually input graph
-    } else if (mode == 2) {
-        int p1, p2, n = 0;
-        
-        // Prompt user for the number of philosophers
-        std::cout << "NUM PHILOSOPHERS: ";
-        std::cin >> p_cnt;
+// Function to load a graph file through a read-only memory mapping; binary files are built straight
+// from the mapped pairs, text files are parsed as a node count followed by any number of 1-based pairs
+Graph graph_load(const std::string &file) {
+    int fd = open(file.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        std::cerr << "ERROR: file '" << file << "' not found" << std::endl;
+        exit(-1);
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void *map = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) {
+        std::cerr << "ERROR: invalid graph: empty or unreadable file '" << file << "'" << std::endl;
+        exit(-1);
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    const char *data = static_cast<const char *>(map);
+    long n_edges;
+    Graph g;
 
-        // Initialize the graph vector
-        std::vector<std::vector<std::pair<int, Resource*>>> graph(static_cast<unsigned long>(p_cnt));
+    if (size >= sizeof(GraphHeader) && !memcmp(data, GRAPH_MAGIC, sizeof(GraphHeader::magic))) {
+        // Binary format: validate the header and map the packed pairs directly
+        GraphHeader header;
+        memcpy(&header, data, sizeof(header));
+        if (header.version != GRAPH_VERSION || header.node_cnt > INT32_MAX ||
+            header.edge_cnt > (size - sizeof(GraphHeader)) / (2 * sizeof(uint32_t))) {
+            std::cerr << "ERROR: invalid graph: bad binary header" << std::endl;
+            exit(-1);
+        }
+        p_cnt = static_cast<int>(header.node_cnt);
+        n_edges = static_cast<long>(header.edge_cnt);
+        g = graph_build(p_cnt, reinterpret_cast<const uint32_t *>(data + sizeof(GraphHeader)), n_edges);
+    } else {
+        // Text format: read the number of philosophers, then edge pairs until the end of the file
+        const char *cursor = data, *end = data + size;
+        uint64_t value, p1, p2;
+        if (!parse_number(cursor, end, value) || value > INT32_MAX) {
+            std::cerr << "ERROR: invalid graph" << std::endl;
+            exit(-1);
+        }
+        p_cnt = static_cast<int>(value);
 
-        // Prompt user for edge pairs until '0' is entered
-        std::cout << "EDGE PAIRS (0 to exit):" << std::endl;
-        while (true) {
-            std::cin >> p1 >> p2;
-            
-            // Exit loop if '0' is entered
-            if (p1 < 1 || p2 < 1 || p1 > p_cnt || p2 > p_cnt) break;
+        std::vector<uint32_t> pairs;
+        pairs.reserve(size / 4);
+        while (parse_number(cursor, end, p1)) {
+            if (!parse_number(cursor, end, p2)) {
+                std::cerr << "ERROR: invalid graph: odd number of edge endpoints" << std::endl;
+                exit(-1);
+            }
 
-            // Create positive and negative resources for forks and bottles
-            Resource *pos = new Resource(), *neg = new Resource();
-            pos->fork.hold = pos->bottle.hold = true;
-            neg->fork.reqf = neg->bottle.reqb = true;
+            // Validate edge pairs; 0 would wrap around to an out-of-range id
+            pairs.push_back(static_cast<uint32_t>(p1 - 1));
+            pairs.push_back(static_cast<uint32_t>(p2 - 1));
+        }
+        n_edges = static_cast<long>(pairs.size() / 2);
+        g = graph_build(p_cnt, pairs.data(), n_edges);
+    }
+    munmap(map, size);
 
-            // Add the edge pairs to the graph
-            graph[p1 - 1].push_back(std::make_pair(p2 - 1, p1 < p2 ? pos : neg));
-            graph[p2 - 1].push_back(std::make_pair(p1 - 1, p1 < p2 ? neg : pos));
+    // Validate the number of edges in the graph
+    if (n_edges < static_cast<long>(p_cnt) - 1) {
+        std::cerr << "ERROR: invalid graph" << std::endl;
+        exit(-1);
+    }
+    return g;
+}
 
-            n++;
-        }
+// Function to write the current graph in the binary format
+void graph_save(const std::string &file) {
+    std::ofstream out(file, std::ios::binary);
+    GraphHeader header;
+    memcpy(header.magic, GRAPH_MAGIC, sizeof(header.magic));
+    header.version = GRAPH_VERSION;
+    header.node_cnt = static_cast<uint32_t>(p_cnt);
+    header.reserved = 0;
+    header.edge_cnt = graph.arena.size();
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
 
-        // Validate the number of edges in the graph
-        if (n < p_cnt - 1 || n > (p_cnt * (p_cnt - 1) / 2)) {
-            std::cerr << "ERROR: invalid graph" << std::endl;
-            exit(-1);
+    // Each edge is written once, from the slot of its lower-numbered philosopher
+    for (int i = 0; i < p_cnt; i++) {
+        for (long e = graph.offsets[i]; e < graph.offsets[i + 1]; e++) {
+            if (graph.side[e] == 0) {
+                uint32_t pair[2] = {static_cast<uint32_t>(i), static_cast<uint32_t>(graph.neighbor[e])};
+                out.write(reinterpret_cast<const char *>(pair), sizeof(pair));
+            }
         }
+    }
+    if (!out) {
+        std::cerr << "ERROR: cannot write '" << file << "'" << std::endl;
+        exit(-1);
+    }
+}
+
+// Function to initialize the dining graph based on the selected mode
+Graph graph_initialize(int mode) {
+    std::vector<uint32_t> pairs;
+
+    // Mode 1: Read graph from file
+    if (mode == 1) {
+        return graph_load(path);
 
-        return graph;
+    // Mode 2: Start without philosophers; the control channel on stdin adds them and their edges
+    } else if (mode == 2) {
+        p_cnt = 0;
+        return graph_build(0, nullptr, 0);
 
     // Default: Use a predefined graph for mode 3
     } else {
         p_cnt = 5; // Number of philosophers 
-        // Create resources for forks and bottles for a predefined graph
-        Resource *r1a = new Resource, *r2a = new Resource, *r3a = new Resource, *r4a = new Resource, *r5a = new Resource;
-        Resource *r1b = new Resource, *r2b = new Resource, *r3b = new Resource, *r4b = new Resource, *r5b = new Resource;
-        r1a->fork.hold = r2a->fork.hold = r3a->fork.hold = r4a->fork.hold = r5a->fork.hold = true;
-        r1b->fork.reqf = r2b->fork.reqf = r3b->fork.reqf = r4b->fork.reqf = r5b->fork.reqf = true;
-        r1a->bottle.hold = r2a->bottle.hold = r3a->bottle.hold = r4a->bottle.hold = r5a->bottle.hold = true;
-        r1b->bottle.reqb = r2b->bottle.reqb = r3b->bottle.reqb = r4b->bottle.reqb = r5b->bottle.reqb = true;
-        
-        // Return the predefined graph
-        return {{std::make_pair(1, r1a), std::make_pair(4, r5a)},
-                {std::make_pair(2, r2a), std::make_pair(0, r1b)},
-                {std::make_pair(3, r3a), std::make_pair(1, r2b)},
-                {std::make_pair(4, r4a), std::make_pair(2, r3b)},
-                {std::make_pair(0, r5b), std::make_pair(3, r4b)}};
-    }
-}
-// Function representing the behavior of a philosopher
-void *philosopher(void *pid) {
-    // Wait until the start signal is received
-    while (!start.load());
-    
-    // Get the philosopher's ID
-    long id = (long) pid;
 
-    // Loop through dining sessions
-    for (int session = 0; session < count_session;) {
-        // Obtain references to the resources associated with the philosopher
-        std::vector<std::pair<int, Resource*>> refs = graph[id];
-
-        // Drink state switch
-        switch (drinkState[id]) {
-            // Case when the philosopher is in TRANQUIL state
-            case Drink::TRANQUIL:
-                // Iterate through the philosopher's neighbors and check for available bottles
-                for (std::pair<int, Resource*> ref_pair : refs) {
-                    Resource *resource = ref_pair.second;
-                    resource->bottle.lock.lock();
-                    if (resource->bottle.hold && resource->bottle.reqb && !resource->fork.hold) {
-                        send_bottle(id, ref_pair.first);
-                        resource->bottle.hold = false;
-                    }
-                    resource->bottle.lock.unlock();
-                }
-                tranquil(id);
-                drinkState[id] = Drink::THIRSTY;
-                break;
+        // Return the predefined five-philosopher ring
+        pairs = {0, 1, 1, 2, 2, 3, 3, 4, 0, 4};
+        return graph_build(p_cnt, pairs.data(), 5);
+    }
+}
 
-            // Case when the philosopher is in THIRSTY state
-            case Drink::THIRSTY:
-                // Iterate through the philosopher's neighbors and handle bottle requests
-                for (std::pair<int, Resource*> ref_pair : refs) {
-                    Resource *resource = ref_pair.second;
-                    resource->bottle.lock.lock();
-                    if (resource->bottle.hold && resource->bottle.reqb && !resource->fork.hold) {
-                        send_bottle(id, ref_pair.first);
-                        resource->bottle.hold = false;
-                    }
-                    // If the bottle is not held, wait for a bottle request and send a request
-                    if (!resource->bottle.hold) {
-                        while (!resource->bottle.reqb) {
-                            std::unique_lock<std::mutex> lk(resource->bottle.lock);
-                            resource->bottle.condition.wait(lk);
-                        }
-                        send_bottle_request(id, ref_pair.first);
-                        resource->bottle.reqb = false;
-                    }
-                    resource->bottle.lock.unlock();
-                }
-                drinkState[id] = Drink::DRINKING;
-                break;
+// Function to build a complete graph of n philosophers
+Graph graph_complete(int n) {
+    return graph_generate("complete:" + std::to_string(n));
+}
 
-            // Case when the philosopher is in DRINKING state
-            case Drink::DRINKING:
-                drink(id);
-                print_lock.lock();
-                std::cout << "philosopher " << id + 1 << " drinking" << std::endl;
-                print_lock.unlock();
-                drinkState[id] = Drink::TRANQUIL;
-                session++;
-                // If the session limit is reached, transition to THINKING state
-                if (session == count_session) {
-                    dineState[id] = Dine::THINKING;
-                }
-                break;
-        }
+// Function to build a synthetic graph from a topology spec:
+//   ring:N  complete:N  grid:RxC  er:N:P (Erdos-Renyi, edge probability P)  powerlaw:N:M (Barabasi-Albert, M edges per node)
+Graph graph_generate(const std::string &spec) {
+    std::string kind = spec.substr(0, spec.find(':'));
+    std::string args = spec.find(':') == std::string::npos ? "" : spec.substr(spec.find(':') + 1);
+    const char *cursor = args.c_str();
+    char *end;
+    long a = std::strtol(cursor, &end, 10);
+    double b = *end ? std::strtod(end + 1, nullptr) : 0;
+    std::mt19937_64 rng(1);
+    std::vector<uint32_t> pairs;
+    int n;
 
-        // Dining state switch
-        switch (dineState[id]) {
-            // Case when the philosopher is in THINKING state
-            case Dine::THINKING: 
-                print_lock.lock(); 
-                std::cout << "Thinking time for philosopher " << id + 1 << std::endl;
-                print_lock.unlock();
-
-                // Iterate through the philosopher's neighbors and handle fork requests
-                for (std::pair<int, Resource*> ref_pair : refs) {
-                    auto to = std::find_if(graph[id].begin(), graph[id].end(), [ref_pair](std::pair<int, Resource*> pair) -> bool {return ref_pair.first == pair.first;});
-                    to->second->fork.lock.lock();
-                    // If it's the last session or the fork is held and dirty, send the fork
-                    if (session == count_session || (to->second->fork.hold && to->second->fork.dirty && to->second->fork.reqf)) {
-                        send_fork(id, ref_pair.first);
-                        to->second->fork.hold = false;
-                        to->second->fork.dirty = false;
-                    }
-                    to->second->fork.lock.unlock();
+    // Append one edge pair, lower-numbered philosopher first
+    auto add = [&pairs](long p1, long p2) {
+        pairs.push_back(static_cast<uint32_t>(std::min(p1, p2)));
+        pairs.push_back(static_cast<uint32_t>(std::max(p1, p2)));
+    };
+
+    if (kind == "ring" && a >= 3) {
+        n = static_cast<int>(a);
+        for (long i = 0; i < n; i++) {
+            add(i, (i + 1) % n);
+        }
+    } else if (kind == "complete" && a >= 2) {
+        n = static_cast<int>(a);
+        for (long i = 0; i < n; i++) {
+            for (long j = i + 1; j < n; j++) {
+                add(i, j);
+            }
+        }
+    } else if (kind == "grid" && a >= 1 && *end == 'x' && b >= 1) {
+        long rows = a, cols = static_cast<long>(b);
+        n = static_cast<int>(rows * cols);
+        for (long r = 0; r < rows; r++) {
+            for (long c = 0; c < cols; c++) {
+                if (c + 1 < cols) add(r * cols + c, r * cols + c + 1);
+                if (r + 1 < rows) add(r * cols + c, (r + 1) * cols + c);
+            }
+        }
+    } else if (kind == "er" && a >= 2 && b > 0 && b < 1) {
+        // Skip over absent pairs geometrically so sparse graphs cost O(n + m)
+        n = static_cast<int>(a);
+        std::geometric_distribution<long> skip(b);
+        long v = 1, w = -1;
+        while (v < n) {
+            w += 1 + skip(rng);
+            while (w >= v && v < n) {
+                w -= v;
+                v++;
+            }
+            if (v < n) add(v, w);
+        }
+    } else if (kind == "powerlaw" && a >= 2 && b >= 1) {
+        // Preferential attachment: every endpoint ever used is a candidate, so degree drives the odds
+        n = static_cast<int>(a);
+        long m = static_cast<long>(b);
+        std::vector<long> targets;
+        for (long i = 1; i < n; i++) {
+            std::vector<long> chosen;
+            for (long k = 0; k < std::min(m, i); k++) {
+                long t;
+                do {
+                    t = targets.empty() ? 0 : targets[rng() % targets.size()];
+                    if (std::find(chosen.begin(), chosen.end(), t) != chosen.end()) {
+                        t = static_cast<long>(rng() % static_cast<unsigned long>(i));
+                    }
+                } while (std::find(chosen.begin(), chosen.end(), t) != chosen.end());
+                chosen.push_back(t);
+            }
+            for (long t : chosen) {
+                add(i, t);
+                targets.push_back(i);
+                targets.push_back(t);
+            }
+        }
+    } else {
+        std::cerr << "ERROR: invalid graph spec '" << spec << "'" << std::endl;
+        exit(-1);
+    }
+    return graph_build(n, pairs.data(), static_cast<long>(pairs.size() / 2));
+}
+
+// Function to apply a batch of graph updates while the philosophers run. The new adjacency is built beside
+// the current one, which only this function changes, and is swapped in while every philosopher is between
+// steps; that pause is also the grace period after which the replaced arrays and the arena entries of removed
+// edges can no longer be referenced, so they are freed or recycled without the steps taking any lock
+void graph_update(const std::vector<GraphUpdate> &updates) {
+    // Replay the batch in order against the current graph, keeping the last word on every touched edge
+    std::vector<char> alive(present.begin(), present.end());
+    std::map<std::pair<int, int>, bool> touched;
+    auto linked = [](int p, int q) {
+        auto first = graph.neighbor.begin() + graph.offsets[p], last = graph.neighbor.begin() + graph.offsets[p + 1];
+        return std::find(first, last, q) != last;
+    };
+    for (const GraphUpdate &update : updates) {
+        if (update.p < 0 || update.p >= p_cnt || update.q >= p_cnt) {
+            std::cerr << "WARN: graph update beyond the capacity of " << p_cnt << " philosophers" << std::endl;
+            continue;
+        } else if (update.p == update.q) {
+            std::cerr << "WARN: philosopher " << place_original(update.p) + 1 << " cannot share an edge with itself" << std::endl;
+            continue;
+        }
+        if (update.q < 0 && update.add) {
+            alive[update.p] = true;
+        } else if (update.q < 0) {
+            // A removed philosopher loses every edge it has or was given earlier in the batch
+            alive[update.p] = false;
+            for (long e = graph.offsets[update.p]; e < graph.offsets[update.p + 1]; e++) {
+                touched[std::minmax(update.p, graph.neighbor[e])] = false;
+            }
+            for (std::pair<const std::pair<int, int>, bool> &edge : touched) {
+                if (edge.first.first == update.p || edge.first.second == update.p) {
+                    edge.second = false;
                 }
-                // If it's the last session, break out of the loop
-                if (session == count_session) {
-                    break;
+            }
+        } else {
+            // Adding an edge adds both philosophers with it
+            touched[std::minmax(update.p, update.q)] = update.add;
+            if (update.add) {
+                alive[update.p] = alive[update.q] = true;
+            }
+        }
+    }
+    std::vector<std::pair<int, int>> added, removed;
+    for (const std::pair<const std::pair<int, int>, bool> &edge : touched) {
+        if (edge.second != linked(edge.first.first, edge.first.second)) {
+            (edge.second ? added : removed).push_back(edge.first);
+        }
+    }
+    std::vector<long> joining;
+    long left = 0;
+    for (long i = 0; i < p_cnt; i++) {
+        if (alive[i] && !present[i]) {
+            joining.push_back(i);
+        }
+        left += !alive[i] && present[i];
+    }
+    if (added.empty() && removed.empty() && joining.empty() && !left) {
+        return;
+    }
+
+    // Lay out the new slots: every philosopher keeps its remaining slots in order and appends the new ones
+    Graph next;
+    std::vector<long> degree(static_cast<unsigned long>(p_cnt));
+    for (long i = 0; i < p_cnt; i++) {
+        degree[i] = graph.offsets[i + 1] - graph.offsets[i];
+    }
+    for (const std::pair<int, int> &edge : removed) {
+        degree[edge.first]--;
+        degree[edge.second]--;
+    }
+    for (const std::pair<int, int> &edge : added) {
+        degree[edge.first]++;
+        degree[edge.second]++;
+    }
+    next.offsets.assign(static_cast<unsigned long>(p_cnt) + 1, 0);
+    for (long i = 0; i < p_cnt; i++) {
+        next.offsets[i + 1] = next.offsets[i] + degree[i];
+    }
+    unsigned long slots = static_cast<unsigned long>(next.offsets[p_cnt]);
+    next.neighbor.resize(slots);
+    next.reverse.resize(slots);
+    next.edge.resize(slots);
+    next.side.resize(slots);
+
+    // Drop the slots of removed edges, remembering their arena entries for reuse
+    std::vector<char> dropped(graph.neighbor.size(), false);
+    std::vector<long> retired;
+    for (const std::pair<int, int> &edge : removed) {
+        long first = graph.offsets[edge.first], last = graph.offsets[edge.first + 1];
+        long e = std::find(graph.neighbor.begin() + first, graph.neighbor.begin() + last, edge.second) - graph.neighbor.begin();
+        dropped[e] = dropped[graph.reverse[e]] = true;
+        retired.push_back(graph.edge[e]);
+    }
+    std::vector<long> moved(graph.neighbor.size(), -1);
+    std::vector<long> fill(next.offsets.begin(), next.offsets.end() - 1);
+    for (long i = 0; i < p_cnt; i++) {
+        for (long e = graph.offsets[i]; e < graph.offsets[i + 1]; e++) {
+            if (!dropped[e]) {
+                moved[e] = fill[i]++;
+                next.neighbor[moved[e]] = graph.neighbor[e];
+                next.edge[moved[e]] = graph.edge[e];
+                next.side[moved[e]] = graph.side[e];
+            }
+        }
+    }
+    for (unsigned long e = 0; e < moved.size(); e++) {
+        if (moved[e] >= 0) {
+            next.reverse[moved[e]] = moved[graph.reverse[e]];
+        }
+    }
+
+    // Give every new edge an arena entry retired by an earlier batch, growing the arena when they run out;
+    // a recycled entry starts over with the fork and bottle on side 0 like a fresh one
+    std::vector<long> slot_p, slot_q;
+    std::vector<Resource> grown;
+    long arena_size = static_cast<long>(graph.arena.size());
+    long fresh = std::max(0L, static_cast<long>(added.size()) - static_cast<long>(graph.spare.size()));
+    if (fresh > 0) {
+        std::vector<Resource>(static_cast<unsigned long>(std::max(2 * arena_size, arena_size + fresh))).swap(grown);
+        for (long r = static_cast<long>(grown.size()) - 1; r >= arena_size; r--) {
+            graph.spare.push_back(r);
+        }
+    }
+    for (const std::pair<int, int> &edge : added) {
+        long r = graph.spare.back();
+        graph.spare.pop_back();
+        if (r < arena_size) {
+            resource_reset(graph.arena[r]);
+            if constexpr (PHILO_STATS) {
+                edge_stats[r].lock_acquired = edge_stats[r].lock_contended = edge_stats[r].messages = 0;
+            }
+        }
+        long s1 = fill[edge.first]++, s2 = fill[edge.second]++;
+        next.neighbor[s1] = edge.second;
+        next.neighbor[s2] = edge.first;
+        next.reverse[s1] = s2;
+        next.reverse[s2] = s1;
+        next.edge[s1] = next.edge[s2] = r;
+        slot_p.push_back(s1);
+        slot_q.push_back(s2);
+    }
+
+    // Stop the philosophers and carry their per-slot state over to the new layout
+    std::vector<char> next_wanted(slots, false), next_fixed(slots, true);
+    auto begin = Clock::now();
+    pause_all();
+
+    // A violation report and a metrics scrape read the graph, so they wait for the new layout
+    std::lock_guard<std::mutex> reporting(verify_lock);
+    std::lock_guard<std::mutex> scraping(layout_lock);
+    for (unsigned long e = 0; e < moved.size(); e++) {
+        if (moved[e] >= 0) {
+            next_wanted[moved[e]] = wanted[e];
+            next_fixed[moved[e]] = bottle_fixed[e];
+        }
+    }
+
+    // A new edge starts with a dirty fork and the bottle at the end that ate more recently, so it points the
+    // same way as every other edge between the two and the precedence graph stays acyclic
+    for (unsigned long i = 0; i < added.size(); i++) {
+        bool yields = graph_yields(added[i].first, added[i].second);
+        next.side[slot_p[i]] = yields ? 0 : 1;
+        next.side[slot_q[i]] = yields ? 1 : 0;
+    }
+
+    // Philosophers that leave drop their session and count as finished, those that join start a new one
+    for (long i = 0; i < p_cnt; i++) {
+        if (alive[i] == present[i]) {
+            continue;
+        }
+        if (drinkState[i] == Drink::DRINKING) {
+            drinking_cnt--;
+            drinking_ns += static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(clock_now() - drinking_since[i]).count());
+        }
+        dineState[i] = Dine::THINKING;
+        drinkState[i] = Drink::TRANQUIL;
+        resting[i] = false;
+        present[i] = alive[i];
+        if (verifying) {
+            verify_phils[i].thirsty_at = 0;
+        }
+        if (sessions[i] < count_session) {
+            if (alive[i]) {
+                finished_cnt--;
+            } else {
+                finish();
+            }
+        }
+    }
+
+    // Move the edge states into a grown arena, then publish the new layout
+    if (fresh > 0) {
+        for (long r = 0; r < arena_size; r++) {
+            resource_copy(grown[r], graph.arena[r]);
+        }
+        graph.arena.swap(grown);
+        if constexpr (PHILO_STATS) {
+            std::unique_ptr<EdgeStats[]> stats(new EdgeStats[graph.arena.size()]);
+            for (long r = 0; r < arena_size; r++) {
+                stats[r].lock_acquired = edge_stats[r].lock_acquired.load();
+                stats[r].lock_contended = edge_stats[r].lock_contended.load();
+                stats[r].messages = edge_stats[r].messages.load();
+            }
+            edge_stats.swap(stats);
+        }
+        if (verifying) {
+            std::unique_ptr<std::atomic<long>[]> claims(new std::atomic<long>[graph.arena.size()]);
+            for (unsigned long r = 0; r < graph.arena.size(); r++) {
+                claims[r] = static_cast<long>(r) < arena_size ? verify_claims[r].load() : -1;
+            }
+            verify_claims.swap(claims);
+        }
+    }
+
+    // A drinking philosopher no longer releases the bottles of its removed edges
+    if (verifying) {
+        for (long r : retired) {
+            verify_claims[r] = -1;
+        }
+    }
+    graph.offsets.swap(next.offsets);
+    graph.neighbor.swap(next.neighbor);
+    graph.reverse.swap(next.reverse);
+    graph.edge.swap(next.edge);
+    graph.side.swap(next.side);
+    wanted.swap(next_wanted);
+    bottle_fixed.swap(next_fixed);
+    double paused = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+    pause_release();
+
+    // Removed edges' entries may be recycled by the next batch, as nothing can reach them past the pause
+    graph.spare.insert(graph.spare.end(), retired.begin(), retired.end());
+
+    // Let the ends of every changed edge and every joining philosopher look at their new neighborhood
+    for (const std::vector<std::pair<int, int>> *edges : {&added, &removed}) {
+        for (const std::pair<int, int> &edge : *edges) {
+            wake(edge.first);
+            wake(edge.second);
+        }
+    }
+    for (long i : joining) {
+        wake(i);
+    }
+    std::cerr << "GRAPH: +" << added.size() << " -" << removed.size() << " edges, +" << joining.size() << " -" << left
+              << " philosophers, stopped " << paused << "ms" << std::endl;
+}
+
+// Function to tell whether philosopher p gives way to q on a new edge between them: the one that ate more
+// recently does, or the lower-numbered one as in graph_build
+bool graph_yields(long p, long q) {
+    return meals[p] != meals[q] ? meals[p] > meals[q] : p < q;
+}
+
+// Function representing the thread that reads graph updates from the control channel, one per line with 1-based
+// input ids: "add <p> [<q>]" and "remove <p> [<q>]" change a philosopher or the edge between two, "sleep <ms>"
+// waits before reading on. Lines are applied in batches of whatever has arrived, and closing the channel lets
+// the run complete once its philosophers have
+void *control_reader(void *) {
+    std::ifstream file;
+    if (control_path != "-") {
+        file.open(control_path);
+        if (!file) {
+            std::cerr << "ERROR: cannot open control channel '" << control_path << "'" << std::endl;
+            exit(-1);
+        }
+    }
+    std::istream &input = control_path == "-" ? std::cin : file;
+    std::vector<GraphUpdate> updates;
+    std::string line;
+    while (std::getline(input, line)) {
+        std::istringstream fields(line);
+        std::string command;
+        long p, q;
+        if (!(fields >> command) || command[0] == '#') {
+            // Blank lines and comments
+        } else if (command == "sleep" && fields >> p) {
+            graph_update(updates);
+            updates.clear();
+            std::this_thread::sleep_for(std::chrono::milliseconds(p));
+        } else if ((command == "add" || command == "remove") && fields >> p) {
+            q = fields >> q ? q : 0;
+            if (p < 1 || p > p_cnt || q < 0 || q > p_cnt) {
+                std::cerr << "WARN: no philosopher " << (p < 1 || p > p_cnt ? p : q) << " within the capacity of " << p_cnt
+                          << ", raise -N" << std::endl;
+            } else {
+                updates.push_back(GraphUpdate{command == "add", static_cast<int>(place_renamed(p - 1)),
+                                              q ? static_cast<int>(place_renamed(q - 1)) : -1});
+            }
+        } else {
+            std::cerr << "WARN: unknown control command '" << line << "'" << std::endl;
+        }
+        if (input.rdbuf()->in_avail() <= 0 && !updates.empty()) {
+            graph_update(updates);
+            updates.clear();
+        }
+    }
+    graph_update(updates);
+
+    // The closed channel was the last thing keeping the run open, unless philosophers are still drinking
+    finish();
+    return nullptr;
+}
+
+// Function to place the philosophers on cores: split the graph into one group per worker (or per CPU with
+// a thread per philosopher), first across NUMA nodes and then across the cores of each node, renumber the
+// philosophers so every group is contiguous, and report the edge-cut against the input order
+void place() {
+    placed_from.clear();
+    placed_to.clear();
+    place_group.clear();
+    place_cpu.clear();
+    if (placement == Placement::NONE) {
+        return;
+    }
+
+    // Group g runs on CPU cpus[g % cpus.size()]; CPUs are listed node by node
+    std::vector<int> cpus, nodes;
+    place_topology(cpus, nodes);
+    int k = workers > 0 ? workers : static_cast<int>(std::min<long>(static_cast<long>(cpus.size()), p_cnt));
+    std::vector<int> group_node(static_cast<unsigned long>(k));
+    for (int g = 0; g < k; g++) {
+        group_node[g] = nodes[g % cpus.size()];
+    }
+    std::vector<int> node_ids(group_node);
+    std::sort(node_ids.begin(), node_ids.end());
+    node_ids.erase(std::unique(node_ids.begin(), node_ids.end()), node_ids.end());
+
+    // Split across NUMA nodes in proportion to the groups each one runs
+    std::vector<int> all(static_cast<unsigned long>(p_cnt));
+    for (int i = 0; i < p_cnt; i++) {
+        all[i] = i;
+    }
+    std::vector<int> node_of(static_cast<unsigned long>(p_cnt), 0);
+    std::vector<long> target(node_ids.size());
+    for (unsigned long d = 0; d < node_ids.size(); d++) {
+        long groups = std::count(group_node.begin(), group_node.end(), node_ids[d]);
+        target[d] = static_cast<long>(p_cnt) * groups / k;
+    }
+    target.back() += p_cnt - std::accumulate(target.begin(), target.end(), 0L);
+    place_split(graph, all, target, node_of);
+
+    // Split the philosophers of every node evenly across its groups
+    std::vector<int> group(static_cast<unsigned long>(p_cnt), 0), part(static_cast<unsigned long>(p_cnt), 0);
+    for (unsigned long d = 0; d < node_ids.size(); d++) {
+        std::vector<int> members, groups;
+        for (int i = 0; i < p_cnt; i++) {
+            if (node_of[i] == static_cast<int>(d)) {
+                members.push_back(i);
+            }
+        }
+        for (int g = 0; g < k; g++) {
+            if (group_node[g] == node_ids[d]) {
+                groups.push_back(g);
+            }
+        }
+        std::vector<long> even(groups.size(), static_cast<long>(members.size() / groups.size()));
+        even.back() += static_cast<long>(members.size() % groups.size());
+        place_split(graph, members, even, part);
+        for (int i : members) {
+            group[i] = groups[part[i]];
+        }
+    }
+
+    // Count cut and cross-node edges for contiguous blocks of the input order and for the placement
+    long cut[2] = {0, 0}, remote[2] = {0, 0};
+    for (int i = 0; i < p_cnt; i++) {
+        for (long e = graph.offsets[i]; e < graph.offsets[i + 1]; e++) {
+            int j = graph.neighbor[e];
+            if (graph.side[e] != 0) {
+                continue;
+            }
+            long block_i = static_cast<long>(i) * k / p_cnt, block_j = static_cast<long>(j) * k / p_cnt;
+            cut[0] += block_i != block_j;
+            remote[0] += group_node[block_i] != group_node[block_j];
+            cut[1] += group[i] != group[j];
+            remote[1] += group_node[group[i]] != group_node[group[j]];
+        }
+    }
+
+    // Keep the input order when the placement does not cut fewer edges than its contiguous blocks
+    bool kept = cut[1] >= cut[0];
+    if (kept) {
+        for (int i = 0; i < p_cnt; i++) {
+            group[i] = static_cast<int>(static_cast<long>(i) * k / p_cnt);
+        }
+        cut[1] = cut[0];
+        remote[1] = remote[0];
+    }
+
+    // Renumber group by group, keeping the input order within a group
+    placed_from = all;
+    std::stable_sort(placed_from.begin(), placed_from.end(), [&group](int a, int b) {
+        return group[a] < group[b];
+    });
+    placed_to.resize(static_cast<unsigned long>(p_cnt));
+    place_group.resize(static_cast<unsigned long>(p_cnt));
+    for (int i = 0; i < p_cnt; i++) {
+        placed_to[placed_from[i]] = i;
+        place_group[i] = group[placed_from[i]];
+    }
+    for (int g = 0; g < k; g++) {
+        place_cpu.push_back(cpus[g % cpus.size()]);
+    }
+
+    std::cerr << "PLACEMENT: " << k << " groups on " << cpus.size() << " cpus in " << node_ids.size() << " numa nodes, edge-cut "
+              << cut[0] << " -> " << cut[1] << ", cross-numa " << remote[0] << " -> " << remote[1] << " of " << graph.arena.size()
+              << " edges" << (kept ? ", kept the input order" : "") << std::endl;
+
+    // Rebuild the graph under the new ids, each edge from its lower-numbered end so resources follow their groups
+    std::vector<uint32_t> pairs;
+    pairs.reserve(2 * graph.arena.size());
+    for (int i = 0; i < p_cnt; i++) {
+        int from = placed_from[i];
+        for (long e = graph.offsets[from]; e < graph.offsets[from + 1]; e++) {
+            int j = placed_to[graph.neighbor[e]];
+            if (i < j) {
+                pairs.push_back(static_cast<uint32_t>(i));
+                pairs.push_back(static_cast<uint32_t>(j));
+            }
+        }
+    }
+    graph = graph_build(p_cnt, pairs.data(), static_cast<long>(pairs.size() / 2));
+}
+
+// Function to split a set of philosophers into groups of the target sizes: seed once with contiguous runs of the
+// input order and once by growing compact groups one after another, refine both by letting each philosopher join
+// the group most of its neighbors are in while that group has room (size-constrained label propagation, every move
+// lowers the cut), and keep whichever ends with the lower cut; neighbors outside the set are ignored
+void place_split(const Graph &g, const std::vector<int> &members, const std::vector<long> &target, std::vector<int> &group) {
+    constexpr int ROUNDS = 16;
+    int k = static_cast<int>(target.size());
+    unsigned long n = g.offsets.size() - 1;
+
+    // Contiguous runs of the input order, which generated meshes and rings already number well
+    long filled = 0;
+    int run = 0;
+    for (int v : members) {
+        while (run < k - 1 && filled == target[run]) {
+            run++;
+            filled = 0;
+        }
+        group[v] = run;
+        filled++;
+    }
+    if (k == 1) {
+        return;
+    }
+
+    // Breadth-first order over the set, one traversal per connected component
+    std::vector<char> inside(n, false), seen(n, false);
+    for (int v : members) {
+        inside[v] = true;
+    }
+    std::vector<int> order;
+    order.reserve(members.size());
+    for (int root : members) {
+        if (seen[root]) {
+            continue;
+        }
+        seen[root] = true;
+        order.push_back(root);
+        for (unsigned long head = order.size() - 1; head < order.size(); head++) {
+            int v = order[head];
+            for (long e = g.offsets[v]; e < g.offsets[v + 1]; e++) {
+                int u = g.neighbor[e];
+                if (inside[u] && !seen[u]) {
+                    seen[u] = true;
+                    order.push_back(u);
+                }
+            }
+        }
+    }
+
+    // Grow the groups one after another from the first philosopher left over in breadth-first order, always taking
+    // the frontier philosopher with the most neighbors already in the group (the earliest in breadth-first order on
+    // a tie), so each group fills out a compact block rather than the diamond of plain breadth-first growth
+    std::vector<long> position(n, 0);
+    for (unsigned long i = 0; i < order.size(); i++) {
+        position[order[i]] = static_cast<long>(i);
+    }
+    std::vector<int> grown(n, 0), links(n, 0), touched;
+    std::vector<long> size(static_cast<unsigned long>(k), 0);
+    std::vector<char> taken(n, false);
+    std::priority_queue<std::pair<int, long>> frontier;
+    unsigned long next = 0;
+    for (int p = 0; p < k; p++) {
+        frontier = {};
+        while (size[p] < target[p]) {
+            int v = -1;
+            while (v < 0 && !frontier.empty()) {
+                int u = order[-frontier.top().second];
+                if (!taken[u] && links[u] == frontier.top().first) {
+                    v = u;
+                }
+                frontier.pop();
+            }
+            if (v < 0) {
+                while (taken[order[next]]) {
+                    next++;
+                }
+                v = order[next];
+            }
+            taken[v] = true;
+            grown[v] = p;
+            size[p]++;
+            for (long e = g.offsets[v]; e < g.offsets[v + 1]; e++) {
+                int u = g.neighbor[e];
+                if (inside[u] && !taken[u]) {
+                    if (links[u]++ == 0) {
+                        touched.push_back(u);
+                    }
+                    frontier.emplace(links[u], -position[u]);
+                }
+            }
+        }
+        for (int u : touched) {
+            links[u] = 0;
+        }
+        touched.clear();
+    }
+
+    // Allow about 3% imbalance so philosophers can move at all
+    std::vector<long> limit(static_cast<unsigned long>(k)), votes(static_cast<unsigned long>(k), 0);
+    for (int p = 0; p < k; p++) {
+        limit[p] = target[p] + target[p] / 32 + 1;
+    }
+    auto refine = [&g, &members, &inside, &order, &limit, &votes, k](std::vector<int> &label) {
+        std::vector<long> count(static_cast<unsigned long>(k), 0);
+        for (int v : members) {
+            count[label[v]]++;
+        }
+        for (int round = 0; round < ROUNDS; round++) {
+            long moved = 0;
+            for (int v : order) {
+                int best = label[v];
+                for (long e = g.offsets[v]; e < g.offsets[v + 1]; e++) {
+                    if (inside[g.neighbor[e]]) {
+                        votes[label[g.neighbor[e]]]++;
+                    }
+                }
+                for (long e = g.offsets[v]; e < g.offsets[v + 1]; e++) {
+                    int p = inside[g.neighbor[e]] ? label[g.neighbor[e]] : best;
+                    if (votes[p] > votes[best] && count[p] < limit[p] && count[label[v]] > 1) {
+                        best = p;
+                    }
+                }
+                for (long e = g.offsets[v]; e < g.offsets[v + 1]; e++) {
+                    if (inside[g.neighbor[e]]) {
+                        votes[label[g.neighbor[e]]] = 0;
+                    }
+                }
+                if (best != label[v]) {
+                    count[label[v]]--;
+                    count[best]++;
+                    label[v] = best;
+                    moved++;
+                }
+            }
+            if (!moved) {
+                break;
+            }
+        }
+
+        // The cut within the set, each edge counted from its lower end
+        long cut = 0;
+        for (int v : members) {
+            for (long e = g.offsets[v]; e < g.offsets[v + 1]; e++) {
+                int u = g.neighbor[e];
+                cut += inside[u] && v < u && label[v] != label[u];
+            }
+        }
+        return cut;
+    };
+    long runs = refine(group);
+    if (refine(grown) < runs) {
+        for (int v : members) {
+            group[v] = grown[v];
+        }
+    }
+}
+
+// Function to list the CPUs this process may run on and the NUMA node of each, sorted node by node
+void place_topology(std::vector<int> &cpus, std::vector<int> &nodes) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    sched_getaffinity(0, sizeof(set), &set);
+    std::vector<std::pair<int, int>> found;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &set)) {
+            continue;
+        }
+
+        // The node shows up as a nodeN entry in the CPU's sysfs directory, node 0 when there is none
+        int node = 0;
+        std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+        if (DIR *d = opendir(dir.c_str())) {
+            while (dirent *entry = readdir(d)) {
+                if (!strncmp(entry->d_name, "node", 4) && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+                    node = static_cast<int>(std::strtol(entry->d_name + 4, nullptr, 10));
+                }
+            }
+            closedir(d);
+        }
+        found.emplace_back(node, cpu);
+    }
+    if (found.empty()) {
+        found.emplace_back(0, 0);
+    }
+    std::sort(found.begin(), found.end());
+    for (const std::pair<int, int> &entry : found) {
+        nodes.push_back(entry.first);
+        cpus.push_back(entry.second);
+    }
+}
+
+// Function to pin the calling thread to the CPU of a placement group
+void place_pin(long group) {
+    if (place_cpu.empty()) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(place_cpu[group], &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Function to translate the id a philosopher runs under back to its id in the input
+long place_original(long id) {
+    return placed_from.empty() ? id : placed_from[id];
+}
+
+// Function to translate an input id to the id the philosopher runs under, leaving invalid ids alone
+long place_renamed(long id) {
+    return placed_to.empty() || id < 0 || id >= p_cnt ? id : placed_to[id];
+}
+
+// Function to measure the per-session message cost on complete graphs
+void bench_graph() {
+    // The messages are sent outside a run, so there is no worker pool to schedule the philosophers they wake
+    if (workers > 0 || coroutines || batch) {
+        std::cerr << "ERROR: --bench-graph sends messages without running the philosophers, drop -w, -O and -M" << std::endl;
+        exit(-1);
+    }
+    // Nor are the graphs partitioned, so there is no owner table or transport to route a remote message through
+    if (partitions > 1 || transport != Transport::DIRECT) {
+        std::cerr << "ERROR: --bench-graph does not partition its graphs, drop -P and -T" << std::endl;
+        exit(-1);
+    }
+    // Nor is the verifier state allocated for them, and the random graphs of -X would never run
+    if (verifying || verify_count > 0) {
+        std::cerr << "ERROR: --bench-graph does not verify its graphs, drop -V and -X" << std::endl;
+        exit(-1);
+    }
+    std::cout << "nodes,degree,csr_ns_per_session,scan_ns_per_session" << std::endl;
+    for (int n = 64; n <= 1024; n *= 2) {
+        p_cnt = n;
+        graph = graph_complete(n);
+        signals.reset(new Signal[n]);
+        if constexpr (PHILO_STATS) {
+            phil_stats.reset(new PhilStats[n]);
+            edge_stats.reset(new EdgeStats[graph.arena.size()]);
+        }
+
+        // A session in the worst case requests and receives every fork and bottle
+        auto begin = Clock::now();
+        for (long id = 0; id < n; id++) {
+            for (long e = graph.offsets[id]; e < graph.offsets[id + 1]; e++) {
+                send_fork_request(id, e);
+                send_fork(id, e);
+                send_bottle_request(id, e);
+                send_bottle(id, e);
+            }
+        }
+        double csr = std::chrono::duration<double, std::nano>(Clock::now() - begin).count() / n;
+
+        // The same messages with the reverse edge located by scanning the neighbor's adjacency
+        volatile long found = 0;
+        begin = Clock::now();
+        for (long id = 0; id < n; id++) {
+            for (long e = graph.offsets[id]; e < graph.offsets[id + 1]; e++) {
+                int to = graph.neighbor[e];
+                for (int k = 0; k < 4; k++) {
+                    auto first = graph.neighbor.begin() + graph.offsets[to];
+                    auto last = graph.neighbor.begin() + graph.offsets[to + 1];
+                    found = found + (std::find(first, last, id) - first);
                 }
+                send_fork_request(id, e);
+                send_fork(id, e);
+                send_bottle_request(id, e);
+                send_bottle(id, e);
+            }
+        }
+        double scan = std::chrono::duration<double, std::nano>(Clock::now() - begin).count() / n;
+
+        std::cout << n << "," << n - 1 << "," << static_cast<long>(csr) << "," << static_cast<long>(scan) << std::endl;
+    }
+}
+
+// Function representing the behavior of a philosopher on its own thread
+void *philosopher(void *pid) {
+    // Wait until the start signal is received
+    gate_wait(start);
+    
+    // Get the philosopher's ID and run on its group's core when placed
+    long id = (long) pid;
+    if (!place_group.empty()) {
+        place_pin(place_group[id]);
+    }
+
+    // Advance the state machine, sleeping or parking between steps
+    while (true) {
+        // Read the epoch before clearing the pending flag: whoever sets the flag again bumps the epoch after this
+        // read, so a wakeup skipped while the flag is set still ends the wait below
+        unsigned seen = signals[id].epoch.load();
+        if (batch) {
+            signals[id].pending = false;
+        }
+        Step step = pause_step(id);
+        if (step == Step::DONE) {
+            break;
+        }
+        if (step == Step::SLEEPING) {
+            if (rest_time[id] > 0) {
+                usleep(rest_time[id]);
+            }
+            continue;
+        }
+
+        // Wait until a neighbor delivers a message or the run completes
+        wait_message(id, seen);
+    }
+    return nullptr;
+}
+
+// Function to relax the CPU for one iteration of a spin
+inline void spin_pause() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Function to wait on a philosopher's own thread for a message, or the end of the run: spin for a budget learned
+// from the waits that spinning ended, then yield a few times, then park. A wait ended within the budget pulls it
+// towards its own length, with room to double, and one that spins out shrinks it, so the philosophers whose
+// handoffs complete quickly skip the sleep and, finding nobody parked, their neighbors skip the wakeup
+void wait_message(long id, unsigned seen) {
+    Signal &signal = signals[id];
+    auto arrived = [&signal, seen] {
+        return signal.epoch.load() != seen || finished_cnt.load(std::memory_order_relaxed) == p_cnt;
+    };
+    if (spin_max > 0) {
+        long limit = std::min(spin_max, 2 * signal.spin_budget + SPIN_MIN);
+        for (long spins = 0; spins < limit; spins++) {
+            if (arrived()) {
+                signal.spin_budget += (spins - signal.spin_budget) / 8;
+                signal.spun++;
+                return;
+            }
+            spin_pause();
+        }
+        signal.spin_budget -= signal.spin_budget / 8 + 1;
+        signal.spin_budget = std::max(0L, signal.spin_budget);
+        for (int i = 0; i < SPIN_YIELDS; i++) {
+            sched_yield();
+            if (arrived()) {
+                signal.yielded++;
+                return;
+            }
+        }
+    }
+
+    // Park, announcing it first: a sender bumps the epoch before checking the flag, so either it sees the flag
+    // and wakes us or we see its epoch and never sleep
+    signal.slept++;
+    if (engine == Engine::ATOMIC) {
+        signal.parked = true;
+        signal.epoch.wait(seen);
+        signal.parked = false;
+        return;
+    }
+    std::unique_lock<std::mutex> lk(signal.lock);
+    signal.parked = true;
+    signal.condition.wait(lk, arrived);
+    signal.parked = false;
+}
+
+// Function representing a philosopher as a coroutine on the worker pool: the loop of philosopher() with every wait
+// a suspension, so a waiting philosopher costs its pooled frame rather than a thread and its stack
+Task philosopher_coroutine(long id) {
+    while (true) {
+        if (batch) {
+            signals[id].pending = false;
+        }
+        Step step = pause_step(id);
+        if (step == Step::DONE) {
+            co_return;
+        }
+        if (step == Step::SLEEPING) {
+            co_await RestAwaiter{id};
+        } else {
+            co_await MessageAwaiter{id};
+        }
+    }
+}
+
+// Functions to find the edge slots of the generic engine in the CSR arrays of the graph
+inline long CsrTopology::first(long id) { return graph.offsets[id]; }
+inline long CsrTopology::last(long id) { return graph.offsets[id + 1]; }
+inline long CsrTopology::owner(long e) { return graph.neighbor[graph.reverse[e]]; }
+inline long CsrTopology::neighbor(long e) { return graph.neighbor[e]; }
+inline long CsrTopology::reverse(long e) { return graph.reverse[e]; }
+inline long CsrTopology::edge(long e) { return graph.edge[e]; }
+inline int CsrTopology::side(long e) { return graph.side[e]; }
+
+// Function to check that the graph is laid out slot for slot like a compiled-in topology
+template <typename Topology>
+bool topology_matches() {
+    long n = static_cast<long>(graph.offsets.size()) - 1;
+    if (n < 1 || Topology::last(n - 1) != static_cast<long>(graph.neighbor.size())) {
+        return false;
+    }
+    for (long id = 0; id < n; id++) {
+        if (Topology::first(id) != graph.offsets[id] || Topology::last(id) != graph.offsets[id + 1]) {
+            return false;
+        }
+    }
+    for (long e = 0; e < static_cast<long>(graph.neighbor.size()); e++) {
+        if (Topology::owner(e) != graph.neighbor[graph.reverse[e]] || Topology::neighbor(e) != graph.neighbor[e] ||
+            Topology::reverse(e) != graph.reverse[e] ||
+            Topology::edge(e) != graph.edge[e] || Topology::side(e) != graph.side[e]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Function to advance a philosopher's state machine with the step of the generic engine or of the compiled-in
+// topology picked for the graph
+Step philosopher_step(long id) {
+    return stepper(id);
+}
+
+// Function to advance a philosopher's state machine as far as it can go without blocking, finding its edge slots
+// through a topology: the CSR arrays, or slots computed at compile time for a fixed one
+template <typename Topology>
+Step philosopher_step_on(long id) {
+    // A philosopher removed from a dynamic graph, or not added yet, has nothing to do
+    if (dynamic && !present[id]) {
+        return finished_cnt.load() == p_cnt ? Step::DONE : Step::BLOCKED;
+    }
+
+    // Obtain the range of edge slots associated with the philosopher
+    long first = Topology::first(id), last = Topology::last(id);
+    bool moved = resting[id];
+    if constexpr (PHILO_STATS) {
+        phil_stats[id].steps.fetch_add(1, std::memory_order_relaxed);
+        stats_stop(phil_stats[id].blocked_at, phil_stats[id].parked_ns);
+    }
+
+    // Check the protocol invariants on a sample of the steps, before the step changes anything
+    if (verifying && verify_sample(id)) {
+        verify_step(id);
+    }
+
+    // Complete a tranquil or drinking period that ended since the last step
+    if (resting[id]) {
+        resting[id] = false;
+        if constexpr (PHILO_STATS) {
+            stats_stop(phil_stats[id].resting_at, phil_stats[id].resting_ns);
+        }
+        if (drinkState[id] == Drink::TRANQUIL) {
+            bottles_choose(id);
+            drinkState[id] = Drink::THIRSTY;
+            log_event(id, Event::THIRSTY);
+            if (verifying) {
+                verify_record(id, Verify::THIRSTY);
+                verify_phils[id].thirsty_at = static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(clock_now() - run_start).count()) + 1;
+            }
+            if (measure) {
+                thirsty_since[id] = clock_now();
+            }
+            if constexpr (PHILO_STATS) {
+                stats_start(phil_stats[id].thirsty_at);
+            }
+        } else if (drinkState[id] == Drink::DRINKING) {
+            log_event(id, Event::DRANK);
+            if (verifying) {
+                verify_unclaim(id);
+                verify_record(id, Verify::DRANK);
+            }
+            drinkState[id] = Drink::TRANQUIL;
+            drinking_cnt--;
+            drinking_ns += static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(clock_now() - drinking_since[id]).count());
+
+            // Once the session limit is reached, the philosopher only serves its neighbors
+            if (++sessions[id] == count_session) {
+                transport_finished(id);
+                finish();
+            }
+        }
+    }
+
+    bool progress = true;
+    while (progress) {
+        progress = false;
+
+        // Iterate through the philosopher's neighbors and handle fork and bottle requests, holding back the
+        // wakeups until the pass is over when batching
+        batch_deferring = batch;
+        for (long e = first; e < last; e++) {
+            Resource *resource = &graph.arena[Topology::edge(e)];
+            int s = Topology::side(e);
+            bool fork, fork_token, dirty, bottle, bottle_token;
+
+            // Take a view of our side of the edge, from one atomic load or under the resource locks
+            if (engine == Engine::ATOMIC) {
+                unsigned word = resource->fork.word.load(std::memory_order_acquire);
+                fork = ((word & FORK_AT) != 0) == (s == 1);
+                fork_token = ((word & FORK_TOKEN) != 0) == (s == 1);
+                dirty = (word & FORK_DIRTY) != 0;
+                bottle = ((word & BOTTLE_AT) != 0) == (s == 1);
+                bottle_token = ((word & BOTTLE_TOKEN) != 0) == (s == 1);
+            } else {
+                resource_lock(resource->fork.lock, id, Topology::edge(e));
+                resource_lock(resource->bottle.lock, id, Topology::edge(e));
+                fork = resource->fork.hold[s];
+                fork_token = resource->fork.reqf[s];
+                dirty = resource->fork.dirty[s];
+                bottle = resource->bottle.hold[s];
+                bottle_token = resource->bottle.reqb[s];
+            }
+
+            // A philosopher that is not eating yields a requested fork if it is dirty or not needed
+            bool give_fork = fork && fork_token && dineState[id] != Dine::EATING &&
+                             (dirty || dineState[id] == Dine::THINKING);
+            fork = fork && !give_fork;
+
+            // A requested bottle is kept only if the session needs it, while drinking or while thirsty and holding the fork
+            bool need = drinkState[id] != Drink::TRANQUIL && wanted[e];
+            bool give_bottle = bottle && bottle_token && !(need && (drinkState[id] == Drink::DRINKING || fork));
+
+            // (R1) A hungry philosopher requests each missing fork it holds the request token for
+            bool ask_fork = dineState[id] == Dine::HUNGRY && !fork && fork_token;
+
+            // (R1) A thirsty philosopher requests each missing bottle of the session it holds the request token for
+            bool ask_bottle = drinkState[id] == Drink::THIRSTY && wanted[e] && !bottle && bottle_token;
+
+            // The mutex engine clears our own side before releasing the locks
+            if (engine == Engine::MUTEX) {
+                if (give_fork) {
+                    resource->fork.hold[s] = false;
+                    resource->fork.dirty[s] = false;
+                }
+                if (give_bottle) {
+                    resource->bottle.hold[s] = false;
+                }
+                if (ask_fork) {
+                    resource->fork.reqf[s] = false;
+                }
+                if (ask_bottle) {
+                    resource->bottle.reqb[s] = false;
+                }
+                resource_unlock(resource->bottle.lock);
+                resource_unlock(resource->fork.lock);
+            }
+
+            // Deliver messages without holding our own locks to keep lock order acyclic
+            if (give_fork) send_fork<Topology>(id, e);
+            if (give_bottle) send_bottle<Topology>(id, e);
+            if (ask_fork) send_fork_request<Topology>(id, e);
+            if (ask_bottle) send_bottle_request<Topology>(id, e);
+            progress |= give_fork || give_bottle || ask_fork || ask_bottle;
+        }
+        if (batch) {
+            notify_flush();
+        }
+        moved |= progress;
+
+        // Dining state switch
+        switch (dineState[id]) {
+            // (D1) A thinking, thirsty philosopher becomes hungry
+            case Dine::THINKING:
+                if (drinkState[id] == Drink::THIRSTY) {
+                    dineState[id] = Dine::HUNGRY;
+                    progress = true;
+                    if (verifying) {
+                        verify_record(id, Verify::HUNGRY);
+                    }
+                    if constexpr (PHILO_STATS) {
+                        stats_start(phil_stats[id].hungry_at);
+                    }
+                }
+                break;
+
+            // Case when the philosopher is in HUNGRY state
+            case Dine::HUNGRY: {
+                // Transition to EATING state once all forks are held; a hungry philosopher stays hungry even
+                // if it drank meanwhile, as yielding its clean forks while thinking would reverse their
+                // precedence and could close a cycle of hungry neighbors waiting on each other
+                bool forks = true;
+                for (long e = first; e < last && forks; e++) {
+                    forks = holds_fork<Topology>(e);
+                }
+                if (forks) {
+                    // Set the forks as dirty after eating
+                    for (long e = first; e < last; e++) {
+                        dirty_fork<Topology>(e);
+                    }
+
+                    // Eating puts every neighbor ahead of the philosopher; a dynamic graph stamps the meal
+                    // after the neighbors' own so graph_update can orient new edges the same way. Holding
+                    // every fork, the philosopher sees each neighbor's latest stamp
+                    if (dynamic) {
+                        uint64_t latest = 0;
+                        for (long e = first; e < last; e++) {
+                            latest = std::max(latest, meals[Topology::neighbor(e)]);
+                        }
+                        meals[id] = latest + 1;
+                    }
+                    dineState[id] = Dine::EATING;
+                    progress = true;
+                    if (verifying) {
+                        verify_record(id, Verify::EATING);
+                    }
+                    if constexpr (PHILO_STATS) {
+                        stats_stop(phil_stats[id].hungry_at, phil_stats[id].hungry_ns, phil_stats[id].hungry_hist);
+                    }
+                }
+                break;
+            }
+
+            // Case when the philosopher is in EATING state
+            case Dine::EATING:
+                // If the philosopher is not THIRSTY, transition to THINKING state
+                if (drinkState[id] != Drink::THIRSTY) {
+                    log_event(id, Event::THINKING);
+                    dineState[id] = Dine::THINKING;
+                    progress = true;
+                    if (verifying) {
+                        verify_record(id, Verify::THINKING);
+                    }
+                }
+                break;
+        }
+
+        // A thirsty philosopher holding every bottle of the session starts drinking
+        if (drinkState[id] == Drink::THIRSTY) {
+            bool bottles = true;
+            for (long e = first; e < last && bottles; e++) {
+                bottles = !wanted[e] || holds_bottle<Topology>(e);
+            }
+            if (bottles) {
+                drinkState[id] = Drink::DRINKING;
+                log_event(id, Event::DRINKING);
+                if (verifying) {
+                    verify_claim(id);
+                    verify_record(id, Verify::DRINKING);
+                    verify_phils[id].thirsty_at = 0;
+                }
+                drinking_since[id] = clock_now();
+                for (long now = ++drinking_cnt, max = drinking_max.load(); now > max;) {
+                    if (drinking_max.compare_exchange_weak(max, now)) {
+                        break;
+                    }
+                }
+                if (measure) {
+                    latencies[id].push_back(static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(clock_now() - thirsty_since[id]).count()));
+                }
+                if constexpr (PHILO_STATS) {
+                    stats_stop(phil_stats[id].thirsty_at, phil_stats[id].thirsty_ns, phil_stats[id].thirsty_hist);
+                }
+                progress = true;
+            }
+        }
+    }
+
+    // Count steps that found nothing to do, and start timing the rest or the block that follows
+    if constexpr (PHILO_STATS) {
+        bool blocked = drinkState[id] == Drink::THIRSTY || (drinkState[id] == Drink::TRANQUIL && sessions[id] >= count_session);
+        if (blocked && !moved) {
+            phil_stats[id].spurious.fetch_add(1, std::memory_order_relaxed);
+        }
+        stats_start(blocked ? phil_stats[id].blocked_at : phil_stats[id].resting_at);
+    }
+
+    // Drink state switch
+    switch (drinkState[id]) {
+        // Case when the philosopher is in TRANQUIL state
+        case Drink::TRANQUIL:
+            if (sessions[id] < count_session) {
+                rest_time[id] = tranquil(id);
+                resting[id] = true;
+                return Step::SLEEPING;
+            }
+            break;
+
+        // Case when the philosopher is in DRINKING state
+        case Drink::DRINKING:
+            rest_time[id] = drink(id);
+            resting[id] = true;
+            return Step::SLEEPING;
+
+        // Case when the philosopher is in THIRSTY state
+        case Drink::THIRSTY:
+            break;
+    }
+    return finished_cnt.load() == p_cnt ? Step::DONE : Step::BLOCKED;
+}
+
+// Function to wait until a gate is opened
+void gate_wait(Gate &gate) {
+    std::unique_lock<std::mutex> lk(gate.lock);
+    gate.condition.wait(lk, [&gate] { return gate.open; });
+}
+
+// Function to open a gate and release every waiting thread
+void gate_open(Gate &gate) {
+    {
+        std::lock_guard<std::mutex> lk(gate.lock);
+        gate.open = true;
+    }
+    gate.condition.notify_all();
+}
+
+// Function to signal a philosopher that a message has been delivered to it
+void wake(long id) {
+    if constexpr (PHILO_STATS) {
+        phil_stats[id].wakeups.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (simulating) {
+        sim_wake(id);
+        return;
+    }
+    // Only a parked philosopher needs the wakeup, one spinning or stepping sees the epoch move
+    signals[id].epoch++;
+    if (signals[id].parked.load()) {
+        if (engine == Engine::ATOMIC) {
+            signals[id].epoch.notify_one();
+        } else {
+            // Pass through the lock so the notification cannot fall between the check and the sleep of the waiter
+            {
+                std::lock_guard<std::mutex> lk(signals[id].lock);
+            }
+            signals[id].condition.notify_one();
+        }
+    }
+
+    // On the worker pool, a delivered message makes an idle philosopher runnable
+    if (workers > 0) {
+        Sched state = signals[id].sched.load();
+        while (true) {
+            if (state == Sched::IDLE) {
+                if (signals[id].sched.compare_exchange_weak(state, Sched::QUEUED)) {
+                    schedule(id);
+                    return;
+                }
+            } else if (state == Sched::RUNNING) {
+                if (signals[id].sched.compare_exchange_weak(state, Sched::NOTIFIED)) {
+                    return;
+                }
+            } else {
+                return;
+            }
+        }
+    }
+}
+
+// Function to wake the receiver of a message; when batching, a philosopher passing over its edges queues one
+// wakeup per neighbor until the pass is over, and a wakeup is skipped while an earlier one is still unconsumed
+void notify(long id) {
+    if (!batch) {
+        wake(id);
+    } else if (batch_deferring) {
+        if (batch_targets.empty() || batch_targets.back() != id) {
+            batch_targets.push_back(id);
+        }
+    } else if (!signals[id].pending.exchange(true)) {
+        wake(id);
+    }
+}
+
+// Function to send the wakeups queued during a philosopher's pass over its edges
+void notify_flush() {
+    batch_deferring = false;
+    for (long id : batch_targets) {
+        notify(id);
+    }
+    batch_targets.clear();
+}
+
+// Function to release every parked philosopher and worker once the run completes
+void wake_all() {
+    for (long i = 0; i < p_cnt; i++) {
+        std::lock_guard<std::mutex> lk(signals[i].lock);
+        signals[i].epoch++;
+        signals[i].epoch.notify_all();
+        signals[i].condition.notify_all();
+    }
+    std::lock_guard<std::mutex> lk(pool_lock);
+    pool_condition.notify_all();
+}
+
+// Function to count a philosopher that completed its sessions, releasing everyone once all have
+void finish() {
+    if (++finished_cnt == p_cnt) {
+        wake_all();
+    }
+}
+
+// Function to push a runnable philosopher onto a worker's run queue
+void schedule(long id) {
+    // Placed philosophers go back to the worker of their group, others to the waking worker or round robin
+    long wid = !place_group.empty() ? place_group[id] : worker_id >= 0 ? worker_id : pool_next++ % workers;
+    {
+        std::lock_guard<std::mutex> lk(pool[wid].lock);
+        pool[wid].ready.push_back(id);
+    }
+    queued_cnt++;
+
+    // Wake an idle worker so it can steal the new work
+    std::lock_guard<std::mutex> lk(pool_lock);
+    if (pool_sleepers > 0) {
+        pool_condition.notify_one();
+    }
+}
+
+// Function representing a worker thread multiplexing philosophers from the run queues
+void *worker(void *wid) {
+    worker_id = (long) wid;
+    Worker &self = pool[worker_id];
+    place_pin(worker_id);
+    gate_wait(start);
+
+    while (finished_cnt.load() < p_cnt) {
+        long id = -1;
+        Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(10);
+
+        // Prefer expired timers, then our own queue (newest first), then steal from the others (oldest first)
+        {
+            std::lock_guard<std::mutex> lk(self.lock);
+            if (!self.timers.empty() && self.timers.top().first <= Clock::now()) {
+                id = self.timers.top().second;
+                self.timers.pop();
+            } else if (!self.ready.empty()) {
+                id = self.ready.back();
+                self.ready.pop_back();
+                queued_cnt--;
+            } else if (!self.timers.empty()) {
+                deadline = std::min(deadline, self.timers.top().first);
+            }
+        }
+        for (long i = 1; id < 0 && i < workers; i++) {
+            Worker &victim = pool[(worker_id + i) % workers];
+            std::lock_guard<std::mutex> lk(victim.lock);
+            if (!victim.ready.empty()) {
+                id = victim.ready.front();
+                victim.ready.pop_front();
+                queued_cnt--;
+            }
+        }
+
+        // Sleep until new work is queued or the next timer expires
+        if (id < 0) {
+            std::unique_lock<std::mutex> lk(pool_lock);
+            pool_sleepers++;
+            if (queued_cnt.load() == 0 && finished_cnt.load() < p_cnt) {
+                pool_condition.wait_until(lk, deadline);
+            }
+            pool_sleepers--;
+            continue;
+        }
+
+        // Run the philosopher until it blocks, rerunning it if a message arrived meanwhile; a coroutine does the
+        // same until it suspends itself
+        signals[id].sched = Sched::RUNNING;
+        if (coroutines) {
+            frames[id].resume();
+            continue;
+        }
+        while (true) {
+            if (batch) {
+                signals[id].pending = false;
+            }
+            Step step = pause_step(id);
+            if (step == Step::DONE) {
+                break;
+            }
+            if (step == Step::SLEEPING) {
+                signals[id].sched = Sched::SLEEPING;
+                std::lock_guard<std::mutex> lk(self.lock);
+                self.timers.push(std::make_pair(Clock::now() + std::chrono::microseconds(rest_time[id]), id));
+                break;
+            }
+            Sched state = Sched::RUNNING;
+            if (signals[id].sched.compare_exchange_strong(state, Sched::IDLE)) {
+                break;
+            }
+            signals[id].sched = Sched::RUNNING;
+        }
+    }
+    return nullptr;
+}
+
+// Function to take the frame of a philosopher's coroutine from the pool; every frame has the size of the first,
+// as they all belong to philosopher_coroutine
+void *Task::promise_type::operator new(std::size_t size) {
+    size = (size + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+    if (!frame_pool.size) {
+        frame_pool.size = size;
+    }
+    if (size != frame_pool.size) {
+        return ::operator new(size);
+    }
+    if (frame_pool.free) {
+        void *frame = frame_pool.free;
+        frame_pool.free = *static_cast<void **>(frame);
+        return frame;
+    }
+    if (frame_pool.used == FramePool::BLOCK) {
+        frame_pool.blocks.emplace_back(new char[FramePool::BLOCK * size]);
+        frame_pool.used = 0;
+    }
+    return frame_pool.blocks.back().get() + frame_pool.used++ * size;
+}
+
+// Function to return the frame of a finished or abandoned coroutine to the pool
+void Task::promise_type::operator delete(void *frame, std::size_t size) {
+    size = (size + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+    if (size != frame_pool.size) {
+        ::operator delete(frame);
+        return;
+    }
+    *static_cast<void **>(frame) = frame_pool.free;
+    frame_pool.free = frame;
+}
+
+// Function to suspend a resting philosopher's coroutine until the timer of the worker running it expires
+void RestAwaiter::await_suspend(std::coroutine_handle<>) {
+    signals[id].sched = Sched::SLEEPING;
+    std::lock_guard<std::mutex> lk(pool[worker_id].lock);
+    pool[worker_id].timers.push(std::make_pair(Clock::now() + std::chrono::microseconds(rest_time[id]), id));
+}
+
+// Function to park a blocked philosopher's coroutine until a message makes it runnable, or to carry on at once if
+// one was delivered during the step; once parked, another worker may resume the frame this awaiter lives in
+bool MessageAwaiter::await_suspend(std::coroutine_handle<>) {
+    Sched state = Sched::RUNNING;
+    long philosopher = id;
+    if (signals[philosopher].sched.compare_exchange_strong(state, Sched::IDLE)) {
+        return true;
+    }
+    signals[philosopher].sched = Sched::RUNNING;
+    return false;
+}
+
+// Function to send a fork request from one philosopher to another
+template <typename Topology>
+void send_fork_request(long from, long edge) {
+    // Index the edge's resource and the side the target philosopher owns
+    long to = Topology::neighbor(edge);
+    Resource *resource = &graph.arena[Topology::edge(edge)];
+    int s = 1 - Topology::side(edge);
+
+    // Check that the reverse edge leads back to the sender
+    if (Topology::owner(edge) != from) {
+        std::cerr << "WARN: reverse edge for <" << from << "> not found" << std::endl;
+        return;
+    }
+
+    // Hand messages to the event queue in a discrete-event run, or to the transport for another partition
+    if (simulating && !sim_delivering) {
+        sim_send(from, edge, Message::FORK_REQUEST);
+        return;
+    }
+    if (transport_remote(from, to)) {
+        transport_send(from, edge, Message::FORK_REQUEST);
+        return;
+    }
+
+    // Pass the request token with one atomic operation, or lock the fork resource and set the fork request flag
+    if (engine == Engine::ATOMIC) {
+        resource->fork.word.fetch_xor(FORK_TOKEN, std::memory_order_acq_rel);
+    } else {
+        resource_lock(resource->fork.lock, from, Topology::edge(edge));
+        resource->fork.reqf[s] = true;
+        resource_unlock(resource->fork.lock);
+    }
+    if constexpr (PHILO_STATS) {
+        stats_message(from, edge, Message::FORK_REQUEST);
+    }
+    if (verifying) {
+        verify_message(from, edge, Message::FORK_REQUEST);
+    }
+    notify(to);
+}
+
+// Function to send a fork from one philosopher to another
+template <typename Topology>
+void send_fork(long from, long edge) {
+    // Index the edge's resource and the side the target philosopher owns
+    long to = Topology::neighbor(edge);
+    Resource *resource = &graph.arena[Topology::edge(edge)];
+    int s = 1 - Topology::side(edge);
+
+    // Check that the reverse edge leads back to the sender
+    if (Topology::owner(edge) != from) {
+        std::cerr << "WARN: reverse edge for <" << from << "> not found" << std::endl;
+        return;
+    }
+
+    // Hand messages to the event queue in a discrete-event run, or to the transport for another partition
+    if (simulating && !sim_delivering) {
+        sim_send(from, edge, Message::FORK);
+        return;
+    }
+    if (transport_remote(from, to)) {
+        transport_send(from, edge, Message::FORK);
+        return;
+    }
+
+    // Set the fork as not dirty and hold, then notify the target philosopher; only the sender
+    // changes the dirty bit while it holds the fork, so one exclusive-or both moves and cleans it
+    if (engine == Engine::ATOMIC) {
+        unsigned word = resource->fork.word.load(std::memory_order_relaxed);
+        resource->fork.word.fetch_xor(FORK_AT | (word & FORK_DIRTY), std::memory_order_acq_rel);
+    } else {
+        resource_lock(resource->fork.lock, from, Topology::edge(edge));
+        resource->fork.dirty[s] = false;
+        resource->fork.hold[s] = true;
+        resource_unlock(resource->fork.lock);
+    }
+    if constexpr (PHILO_STATS) {
+        stats_message(from, edge, Message::FORK);
+    }
+    if (verifying) {
+        verify_message(from, edge, Message::FORK);
+    }
+    notify(to);
+}
+
+// Function to send a bottle request from one philosopher to another
+template <typename Topology>
+void send_bottle_request(long from, long edge) {
+    // Index the edge's resource and the side the target philosopher owns
+    long to = Topology::neighbor(edge);
+    Resource *resource = &graph.arena[Topology::edge(edge)];
+    int s = 1 - Topology::side(edge);
+
+    // Check that the reverse edge leads back to the sender
+    if (Topology::owner(edge) != from) {
+        std::cerr << "WARN: reverse edge for <" << from << "> not found" << std::endl;
+        return;
+    }
+
+    // Hand messages to the event queue in a discrete-event run, or to the transport for another partition
+    if (simulating && !sim_delivering) {
+        sim_send(from, edge, Message::BOTTLE_REQUEST);
+        return;
+    }
+    if (transport_remote(from, to)) {
+        transport_send(from, edge, Message::BOTTLE_REQUEST);
+        return;
+    }
+
+    // Lock the bottle resource, set the bottle request flag, notify the target philosopher, and unlock the bottle
+    if (engine == Engine::ATOMIC) {
+        resource->fork.word.fetch_xor(BOTTLE_TOKEN, std::memory_order_acq_rel);
+    } else {
+        resource_lock(resource->bottle.lock, from, Topology::edge(edge));
+        resource->bottle.reqb[s] = true;
+        resource_unlock(resource->bottle.lock);
+    }
+    if constexpr (PHILO_STATS) {
+        stats_message(from, edge, Message::BOTTLE_REQUEST);
+    }
+    if (verifying) {
+        verify_message(from, edge, Message::BOTTLE_REQUEST);
+    }
+    notify(to);
+}
+
+// Function to send a bottle from one philosopher to another
+template <typename Topology>
+void send_bottle(long from, long edge) {
+    // Index the edge's resource and the side the target philosopher owns
+    long to = Topology::neighbor(edge);
+    Resource *resource = &graph.arena[Topology::edge(edge)];
+    int s = 1 - Topology::side(edge);
+
+    // Check that the reverse edge leads back to the sender
+    if (Topology::owner(edge) != from) {
+        std::cerr << "WARN: reverse edge for <" << from << "> not found" << std::endl;
+        return;
+    }
+
+    // Hand messages to the event queue in a discrete-event run, or to the transport for another partition
+    if (simulating && !sim_delivering) {
+        sim_send(from, edge, Message::BOTTLE);
+        return;
+    }
+    if (transport_remote(from, to)) {
+        transport_send(from, edge, Message::BOTTLE);
+        return;
+    }
+
+    // Lock the bottle resource, set the bottle as held, unlock the bottle, and notify the target philosopher
+    if (engine == Engine::ATOMIC) {
+        resource->fork.word.fetch_xor(BOTTLE_AT, std::memory_order_acq_rel);
+    } else {
+        resource_lock(resource->bottle.lock, from, Topology::edge(edge));
+        resource->bottle.hold[s] = true;
+        resource_unlock(resource->bottle.lock);
+    }
+    if constexpr (PHILO_STATS) {
+        stats_message(from, edge, Message::BOTTLE);
+    }
+    if (verifying) {
+        verify_message(from, edge, Message::BOTTLE);
+    }
+    notify(to);
+}
+
+// Function to check whether a philosopher holds the fork of one of its edge slots
+template <typename Topology>
+bool holds_fork(long edge) {
+    Resource &resource = graph.arena[Topology::edge(edge)];
+    int s = Topology::side(edge);
+    if (engine == Engine::ATOMIC) {
+        return ((resource.fork.word.load(std::memory_order_acquire) & FORK_AT) != 0) == (s == 1);
+    }
+    resource_lock(resource.fork.lock, Topology::owner(edge), Topology::edge(edge));
+    bool hold = resource.fork.hold[s];
+    resource_unlock(resource.fork.lock);
+    return hold;
+}
+
+// Function to check whether a philosopher holds the bottle of one of its edge slots
+template <typename Topology>
+bool holds_bottle(long edge) {
+    Resource &resource = graph.arena[Topology::edge(edge)];
+    int s = Topology::side(edge);
+    if (engine == Engine::ATOMIC) {
+        return ((resource.fork.word.load(std::memory_order_acquire) & BOTTLE_AT) != 0) == (s == 1);
+    }
+    resource_lock(resource.bottle.lock, Topology::owner(edge), Topology::edge(edge));
+    bool hold = resource.bottle.hold[s];
+    resource_unlock(resource.bottle.lock);
+    return hold;
+}
+
+// Function to mark the fork of one of a philosopher's edge slots as dirty after eating
+template <typename Topology>
+void dirty_fork(long edge) {
+    Resource &resource = graph.arena[Topology::edge(edge)];
+    if (engine == Engine::ATOMIC) {
+        resource.fork.word.fetch_or(FORK_DIRTY, std::memory_order_acq_rel);
+        return;
+    }
+    resource_lock(resource.fork.lock, Topology::owner(edge), Topology::edge(edge));
+    resource.fork.dirty[Topology::side(edge)] = true;
+    resource_unlock(resource.fork.lock);
+}
+
+// Function to check whether a message between two philosophers has to cross partitions through the transport,
+// which is never the case while the transport itself is applying a delivered message
+bool transport_remote(long from, long to) {
+    return transport != Transport::DIRECT && owner[from] != owner[to] && !transport_delivering;
+}
+
+// Function to queue a message for a philosopher in another partition, waking the sender thread on the first one;
+// for FINISHED the edge argument names the receiving partition instead
+void transport_send(long from, long edge, Message type) {
+    int src = owner[from];
+    int dst = type == Message::FINISHED ? static_cast<int>(edge) : owner[graph.neighbor[edge]];
+    Packet packet{++lamport[src],
+                  static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::system_clock::now().time_since_epoch()).count()),
+                  static_cast<uint32_t>(type == Message::FINISHED ? from : edge), type};
+    bool first;
+    {
+        std::lock_guard<std::mutex> lk(transport_lock);
+        std::vector<Packet> &box = outbox[src * partitions + dst];
+        first = box.empty();
+        box.push_back(packet);
+    }
+    transport_sent++;
+    if (first) {
+        transport_condition.notify_one();
+    }
+}
+
+// Function to tell every other process that a philosopher completed its sessions
+void transport_finished(long id) {
+    if (transport != Transport::SOCKET) {
+        return;
+    }
+    for (int p = 0; p < partitions; p++) {
+        if (p != partition) {
+            transport_send(id, p, Message::FINISHED);
+        }
+    }
+}
+
+// Function to split the run into one process per partition, connected pairwise by Unix sockets
+void transport_fork() {
+    // Build the full mesh of socket pairs before forking so every process inherits its ends
+    std::vector<int> mesh(static_cast<unsigned long>(partitions * partitions), -1);
+    for (int i = 0; i < partitions; i++) {
+        for (int j = i + 1; j < partitions; j++) {
+            int sv[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+                perror("socketpair");
+                exit(-1);
+            }
+            mesh[i * partitions + j] = sv[0];
+            mesh[j * partitions + i] = sv[1];
+        }
+    }
+
+    // Partition 0 stays in this process, the others run in children
+    fflush(stdout);
+    partition = 0;
+    for (int p = 1; p < partitions; p++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            exit(-1);
+        }
+        if (pid == 0) {
+            partition = p;
+            children.clear();
+            break;
+        }
+        children.push_back(pid);
+    }
+
+    // Keep only this partition's ends of the mesh
+    peer_fds.assign(static_cast<unsigned long>(partitions), -1);
+    for (int i = 0; i < partitions * partitions; i++) {
+        if (mesh[i] < 0) {
+            continue;
+        }
+        if (i / partitions == partition) {
+            peer_fds[i % partitions] = mesh[i];
+        } else {
+            close(mesh[i]);
+        }
+    }
+}
+
+// Function to deliver a batch of packets to the philosophers of the receiving partition
+void transport_deliver(const BatchHeader &header, const uint64_t *clock, const Packet *packets) {
+    // Merge the sender's vector clock, counting batches already overtaken by news of the sender relayed
+    // through a third partition
+    {
+        std::lock_guard<std::mutex> lk(transport_lock);
+        std::vector<uint64_t> &own = vclocks[header.dst];
+        if (clock[header.src] <= own[header.src]) {
+            transport_reordered++;
+        }
+        for (int p = 0; p < partitions; p++) {
+            own[p] = std::max(own[p], clock[p]);
+        }
+        own[header.dst]++;
+    }
+    transport_batches++;
+
+    uint64_t now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+    transport_delivering = true;
+    for (uint32_t i = 0; i < header.count; i++) {
+        const Packet &packet = packets[i];
+
+        // Advance the receiving partition's Lamport clock past the message's timestamp
+        uint64_t seen = lamport[header.dst].load();
+        while (!lamport[header.dst].compare_exchange_weak(seen, std::max(seen, packet.lamport) + 1)) {
+        }
+        transport_latency.push_back(now > packet.sent ? now - packet.sent : 0);
+        transport_received++;
+
+        // Apply the message as the sender would have in shared memory
+        long edge = packet.edge;
+        long from = packet.type == Message::FINISHED ? edge : graph.neighbor[graph.reverse[edge]];
+        switch (packet.type) {
+            case Message::FORK_REQUEST:
+                send_fork_request(from, edge);
+                break;
+            case Message::FORK:
+                send_fork(from, edge);
+                break;
+            case Message::BOTTLE_REQUEST:
+                send_bottle_request(from, edge);
+                break;
+            case Message::BOTTLE:
+                send_bottle(from, edge);
+                break;
+            case Message::FINISHED:
+                finish();
+                break;
+        }
+    }
+    transport_delivering = false;
+}
+
+// Function representing the thread that flushes the outboxes, one batch per pair of partitions
+void *transport_sender(void *) {
+    std::vector<Packet> packets;
+    std::vector<char> buffer;
+    while (true) {
+        int src = -1, dst = -1;
+        std::vector<uint64_t> clock;
+        {
+            std::unique_lock<std::mutex> lk(transport_lock);
+            for (int i = 0; i < partitions * partitions && src < 0; i++) {
+                if (!outbox[i].empty()) {
+                    src = i / partitions;
+                    dst = i % partitions;
+                    packets.swap(outbox[i]);
+                }
+            }
+            if (src < 0) {
+                if (transport_stop.load()) {
+                    break;
+                }
+                transport_condition.wait_for(lk, std::chrono::milliseconds(10));
+                continue;
+            }
+            vclocks[src][src]++;
+            clock = vclocks[src];
+        }
+
+        // Hand the batch to the receiving partition in-process, or write it to the socket as one message
+        BatchHeader header{static_cast<uint32_t>(src), static_cast<uint32_t>(dst), static_cast<uint32_t>(packets.size()), 0};
+        if (transport == Transport::QUEUE) {
+            transport_deliver(header, clock.data(), packets.data());
+        } else {
+            buffer.resize(sizeof(header) + clock.size() * sizeof(uint64_t) + packets.size() * sizeof(Packet));
+            memcpy(buffer.data(), &header, sizeof(header));
+            memcpy(buffer.data() + sizeof(header), clock.data(), clock.size() * sizeof(uint64_t));
+            memcpy(buffer.data() + sizeof(header) + clock.size() * sizeof(uint64_t), packets.data(), packets.size() * sizeof(Packet));
+            for (size_t done = 0; done < buffer.size();) {
+                ssize_t n = send(peer_fds[dst], buffer.data() + done, buffer.size() - done, MSG_NOSIGNAL);
+                if (n <= 0) {
+                    break;
+                }
+                done += static_cast<size_t>(n);
+            }
+        }
+        packets.clear();
+    }
+    return nullptr;
+}
+
+// Function representing the thread that reads batches from the other processes
+void *transport_receiver(void *) {
+    std::vector<pollfd> fds;
+    for (int p = 0; p < partitions; p++) {
+        if (peer_fds[p] >= 0) {
+            fds.push_back(pollfd{peer_fds[p], POLLIN, 0});
+        }
+    }
+
+    // Read exactly n bytes from a socket, failing on end of stream
+    auto read_all = [](int fd, void *data, size_t n) -> bool {
+        for (size_t done = 0; done < n;) {
+            ssize_t got = read(fd, static_cast<char *>(data) + done, n - done);
+            if (got <= 0) {
+                return false;
+            }
+            done += static_cast<size_t>(got);
+        }
+        return true;
+    };
+
+    std::vector<uint64_t> clock(static_cast<unsigned long>(partitions));
+    std::vector<Packet> packets;
+    while (!transport_stop.load() && !fds.empty()) {
+        if (poll(fds.data(), fds.size(), 10) <= 0) {
+            continue;
+        }
+        for (unsigned long i = 0; i < fds.size(); i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP))) {
+                continue;
+            }
+            BatchHeader header;
+            if (!read_all(fds[i].fd, &header, sizeof(header))) {
+                fds[i].fd = -1;
+                continue;
+            }
+            packets.resize(header.count);
+            if (!read_all(fds[i].fd, clock.data(), clock.size() * sizeof(uint64_t)) ||
+                !read_all(fds[i].fd, packets.data(), packets.size() * sizeof(Packet))) {
+                fds[i].fd = -1;
+                continue;
+            }
+            transport_deliver(header, clock.data(), packets.data());
+        }
+    }
+    return nullptr;
+}
+
+// Function to report the cross-partition message rate, latency and clocks of this process
+void transport_report(double seconds) {
+    std::sort(transport_latency.begin(), transport_latency.end());
+    auto percentile = [](double q) -> double {
+        return transport_latency.empty() ? 0 : static_cast<double>(
+                transport_latency[static_cast<unsigned long>(q * static_cast<double>(transport_latency.size() - 1))]) / 1000;
+    };
+
+    std::cerr << "TRANSPORT: " << (transport == Transport::QUEUE ? "queue" : "socket")
+              << " partition " << (transport == Transport::QUEUE ? std::string("*") : std::to_string(partition))
+              << " sent " << transport_sent.load() << " received " << transport_received.load()
+              << " in " << transport_batches.load() << " batches, "
+              << static_cast<double>(transport_received.load()) / seconds << " msg/s, latency p50 "
+              << percentile(0.5) << "us p99 " << percentile(0.99) << "us, " << transport_reordered.load() << " causally late batches"
+              << std::endl;
+    for (int p = 0; p < partitions; p++) {
+        if (transport == Transport::SOCKET && p != partition) {
+            continue;
+        }
+        std::cerr << "TRANSPORT: partition " << p << " lamport " << lamport[p].load() << " vector [";
+        for (int q = 0; q < partitions; q++) {
+            std::cerr << (q ? " " : "") << vclocks[p][q];
+        }
+        std::cerr << "]" << std::endl;
+    }
+}
+
+// Function to read the clock of the run: the virtual clock in a discrete-event run, the monotonic clock otherwise
+Clock::time_point clock_now() {
+    return simulating ? Clock::time_point(std::chrono::nanoseconds(sim_now)) : Clock::now();
+}
+
+// Function to queue an event; only the ends of rests need the heap, since events for the current time follow
+// every event already queued and messages all take the same latency, so both arrive in order in a FIFO
+void sim_push(const SimEvent &event) {
+    if (event.time == sim_now) {
+        sim_current.push_back(event);
+    } else if (event.edge >= 0) {
+        sim_flight.push_back(event);
+    } else {
+        sim_events.push(event);
+    }
+}
+
+// Function to take the earliest queued event off the front of the heap or either FIFO
+bool sim_pop(SimEvent &event) {
+    std::deque<SimEvent> *fifo = nullptr;
+    if (!sim_current.empty() && (sim_flight.empty() || sim_flight.front() > sim_current.front())) {
+        fifo = &sim_current;
+    } else if (!sim_flight.empty()) {
+        fifo = &sim_flight;
+    }
+    if (!sim_events.empty() && (!fifo || fifo->front() > sim_events.top())) {
+        event = sim_events.top();
+        sim_events.pop();
+    } else if (fifo) {
+        event = fifo->front();
+        fifo->pop_front();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Function to put a message in flight on the virtual clock, to be delivered after the message latency
+void sim_send(long from, long edge, Message type) {
+    sim_push(SimEvent{sim_now + static_cast<uint64_t>(sim_latency * 1000), sim_seq++, from, edge, type});
+}
+
+// Function to schedule a step of a philosopher that a message was delivered to; one that is resting or
+// already scheduled handles the message at its next step anyway
+void sim_wake(long id) {
+    if (signals[id].sched == Sched::IDLE) {
+        signals[id].sched = Sched::QUEUED;
+        sim_push(SimEvent{sim_now, sim_seq++, id, -1, Message::FORK});
+    }
+}
+
+// Function to run the philosophers on one thread against the virtual clock, taking events in time order
+// until every philosopher has completed its sessions
+void sim_run() {
+    // Start every philosopher at time zero, unless the queues were restored from a checkpoint
+    if (!sim_restored) {
+        sim_now = 0;
+        sim_seq = 0;
+        sim_events = decltype(sim_events)();
+        sim_current.clear();
+        sim_flight.clear();
+        for (long i = 0; i < p_cnt; i++) {
+            signals[i].sched = Sched::QUEUED;
+            sim_push(SimEvent{0, sim_seq++, i, -1, Message::FORK});
+        }
+    }
+    sim_restored = false;
+    sim_count = 0;
+
+    SimEvent event;
+    while (finished_cnt.load() < p_cnt) {
+        // Between two events the run is quiescent, so checkpoints are taken right here
+        if (checkpoint_path.length() && sim_count % 4096 == 0) {
+            checkpoint_poll();
+        }
+        if (verifying && sim_count % 4096 == 0) {
+            verify_watch();
+        }
+        if (!sim_pop(event)) {
+            break;
+        }
+        sim_now = event.time;
+        sim_count++;
+
+        // Apply a message the way the sender would have in shared memory
+        if (event.edge >= 0) {
+            sim_delivering = true;
+            switch (event.type) {
+                case Message::FORK_REQUEST:
+                    send_fork_request(event.id, event.edge);
+                    break;
+                case Message::FORK:
+                    send_fork(event.id, event.edge);
+                    break;
+                case Message::BOTTLE_REQUEST:
+                    send_bottle_request(event.id, event.edge);
+                    break;
+                case Message::BOTTLE:
+                    send_bottle(event.id, event.edge);
+                    break;
+                case Message::FINISHED:
+                    break;
+            }
+            sim_delivering = false;
+            continue;
+        }
+
+        // Step the philosopher, and schedule the end of its rest if it starts one
+        signals[event.id].sched = Sched::RUNNING;
+        if (philosopher_step(event.id) == Step::SLEEPING) {
+            signals[event.id].sched = Sched::SLEEPING;
+            sim_push(SimEvent{sim_now + 1000 * static_cast<uint64_t>(rest_time[event.id]), sim_seq++, event.id, -1, Message::FORK});
+        } else {
+            signals[event.id].sched = Sched::IDLE;
+        }
+    }
+
+    // Nothing left to happen with thirsty philosophers is a deadlock or starvation of the protocol
+    if (finished_cnt.load() < p_cnt) {
+        std::cerr << "ERROR: no events left at t=" << static_cast<double>(sim_now) / 1000 << "us with "
+                  << p_cnt - finished_cnt.load() << " philosophers unfinished" << std::endl;
+        exit(-1);
+    }
+}
+
+// Function to compute a 64-bit FNV-1a hash of the graph's adjacency, to tell whether a checkpoint belongs to it
+uint64_t checkpoint_hash() {
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](uint64_t value) {
+        for (int i = 0; i < 8; i++) {
+            hash = (hash ^ ((value >> (8 * i)) & 0xff)) * 1099511628211ull;
+        }
+    };
+    mix(static_cast<uint64_t>(p_cnt));
+    for (int neighbor : graph.neighbor) {
+        mix(static_cast<uint64_t>(neighbor));
+    }
+    return hash;
+}
+
+// Function to read the state of an edge as checkpoint flags, whichever engine holds it; the caller stops the steps
+// or holds the resource locks, and the atomic engine's word is read once
+unsigned checkpoint_edge(long r) {
+    Resource &resource = graph.arena[r];
+    unsigned flags = 0, word = resource.fork.word.load();
+    for (int s = 0; s < 2; s++) {
+        bool fork, fork_token, dirty, bottle, bottle_token;
+        if (engine == Engine::ATOMIC) {
+            fork = ((word & FORK_AT) != 0) == (s == 1);
+            fork_token = ((word & FORK_TOKEN) != 0) == (s == 1);
+            dirty = (word & FORK_DIRTY) != 0;
+            bottle = ((word & BOTTLE_AT) != 0) == (s == 1);
+            bottle_token = ((word & BOTTLE_TOKEN) != 0) == (s == 1);
+        } else {
+            fork = resource.fork.hold[s];
+            fork_token = resource.fork.reqf[s];
+            dirty = resource.fork.dirty[s];
+            bottle = resource.bottle.hold[s];
+            bottle_token = resource.bottle.reqb[s];
+        }
+        flags |= ((fork ? CHECKPOINT_FORK : 0) | (fork_token ? CHECKPOINT_FORK_TOKEN : 0) | (dirty ? CHECKPOINT_DIRTY : 0) |
+                  (bottle ? CHECKPOINT_BOTTLE : 0) | (bottle_token ? CHECKPOINT_BOTTLE_TOKEN : 0)) << s;
+    }
+    return flags;
+}
+
+// Function to capture the state of the run into a buffer; the caller makes sure no philosopher is stepping
+void checkpoint_capture(std::vector<char> &out) {
+    // Queued events of a discrete-event run, in the order they will be taken
+    std::vector<SimEvent> events;
+    if (simulating) {
+        events.assign(sim_current.begin(), sim_current.end());
+        events.insert(events.end(), sim_flight.begin(), sim_flight.end());
+        for (decltype(sim_events) heap = sim_events; !heap.empty(); heap.pop()) {
+            events.push_back(heap.top());
+        }
+        std::sort(events.begin(), events.end(), [](const SimEvent &a, const SimEvent &b) {
+            return b > a;
+        });
+    }
+
+    CheckpointHeader header{};
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.node_cnt = static_cast<uint32_t>(p_cnt);
+    header.simulated = simulating;
+    header.edge_cnt = graph.arena.size();
+    header.graph_hash = checkpoint_hash();
+    header.sim_now = sim_now;
+    header.sim_seq = sim_seq;
+    header.event_cnt = events.size();
+
+    unsigned long slots = graph.neighbor.size();
+    out.resize(sizeof(header) + p_cnt * sizeof(CheckpointPhil) + header.edge_cnt * sizeof(uint16_t) + (slots + 7) / 8 +
+               events.size() * sizeof(SimEvent));
+    char *cursor = out.data();
+    memcpy(cursor, &header, sizeof(header));
+    cursor += sizeof(header);
+    for (long i = 0; i < p_cnt; i++) {
+        CheckpointPhil phil{static_cast<uint32_t>(sessions[i]), rand_seeds[i], static_cast<uint32_t>(rest_time[i]),
+                            static_cast<uint8_t>(dineState[i].load()), static_cast<uint8_t>(drinkState[i].load()),
+                            static_cast<uint8_t>(resting[i]), static_cast<uint8_t>(signals[i].sched.load())};
+        memcpy(cursor, &phil, sizeof(phil));
+        cursor += sizeof(phil);
+    }
+    for (unsigned long r = 0; r < header.edge_cnt; r++) {
+        uint16_t flags = static_cast<uint16_t>(checkpoint_edge(static_cast<long>(r)));
+        memcpy(cursor, &flags, sizeof(flags));
+        cursor += sizeof(flags);
+    }
+    std::fill(cursor, cursor + (slots + 7) / 8, 0);
+    for (unsigned long e = 0; e < slots; e++) {
+        cursor[e / 8] = static_cast<char>(cursor[e / 8] | (wanted[e] ? 1 << (e % 8) : 0));
+    }
+    cursor += (slots + 7) / 8;
+    memcpy(cursor, events.data(), events.size() * sizeof(SimEvent));
+}
+
+// Function to write a captured checkpoint, replacing the previous one only once the new one is complete
+void checkpoint_write(const std::vector<char> &data) {
+    std::string tmp = checkpoint_path + ".tmp";
+    std::ofstream out(tmp, std::ios::binary);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    out.close();
+    if (!out || rename(tmp.c_str(), checkpoint_path.c_str()) < 0) {
+        std::cerr << "ERROR: cannot write checkpoint '" << checkpoint_path << "'" << std::endl;
+    }
+}
+
+// Function to take a checkpoint: stop every philosopher at the end of its current step, copy the state,
+// let them continue and only then write the copy out. A run stopping after the checkpoint stays stopped, so the
+// event log ends exactly where the checkpoint resumes it
+void checkpoint_take(bool stopping) {
+    std::vector<char> data;
+    auto begin = Clock::now();
+    if (simulating) {
+        checkpoint_capture(data);
+    } else {
+        pause_all();
+        checkpoint_capture(data);
+        if (!stopping) {
+            pause_release();
+        }
+    }
+    double paused = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+    checkpoint_write(data);
+    std::cerr << "CHECKPOINT: " << data.size() << " bytes to " << checkpoint_path << ", stopped " << paused << "ms" << std::endl;
+}
+
+// Function to check whether a checkpoint is due, taking it and stopping the run if it was asked for by a signal
+void checkpoint_poll() {
+    if (checkpoint_signal) {
+        checkpoint_take(true);
+        std::cerr << "CHECKPOINT: interrupted, continue with --resume " << checkpoint_path << std::endl;
+
+        // Drain the event log up to the checkpoint before leaving without the usual shutdown
+        if (log_format != LogFormat::NONE) {
+            log_stop = true;
+            pthread_join(log_thread, nullptr);
+        }
+        fflush(stdout);
+        fsync(fileno(stdout));
+        _exit(1);
+    }
+    if (Clock::now() >= checkpoint_next) {
+        checkpoint_take();
+        checkpoint_next = Clock::now() + std::chrono::milliseconds(checkpoint_interval);
+    }
+}
+
+// Function representing the thread that takes the checkpoints of a threaded run
+void *checkpointer(void *) {
+    while (finished_cnt.load() < p_cnt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if (finished_cnt.load() < p_cnt) {
+            checkpoint_poll();
+        }
+    }
+    return nullptr;
+}
+
+// Function to record that SIGINT or SIGTERM arrived, so the run stops after a final checkpoint
+void checkpoint_interrupt(int) {
+    checkpoint_signal = 1;
+}
+
+// Function to restore the state of the run from a checkpoint of the same graph
+void checkpoint_load(const std::string &file) {
+    std::ifstream input(file, std::ios::binary);
+    std::vector<char> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    CheckpointHeader header;
+    unsigned long slots = graph.neighbor.size();
+    if (data.size() < sizeof(header)) {
+        std::cerr << "ERROR: cannot read checkpoint '" << file << "'" << std::endl;
+        exit(-1);
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) || header.version != CHECKPOINT_VERSION ||
+        data.size() != sizeof(header) + p_cnt * sizeof(CheckpointPhil) + header.edge_cnt * sizeof(uint16_t) + (slots + 7) / 8 +
+                       header.event_cnt * sizeof(SimEvent)) {
+        std::cerr << "ERROR: invalid checkpoint '" << file << "'" << std::endl;
+        exit(-1);
+    }
+    if (header.node_cnt != static_cast<uint32_t>(p_cnt) || header.edge_cnt != graph.arena.size() ||
+        header.graph_hash != checkpoint_hash()) {
+        std::cerr << "ERROR: checkpoint '" << file << "' was taken on another graph" << std::endl;
+        exit(-1);
+    }
+    if (header.simulated != simulating) {
+        std::cerr << "ERROR: checkpoint '" << file << "' was taken " << (header.simulated ? "with" : "without")
+                  << " the discrete-event engine" << std::endl;
+        exit(-1);
+    }
+
+    // Philosophers, then edges, then the bottles each philosopher wants for its session
+    const char *cursor = data.data() + sizeof(header);
+    sim_now = header.sim_now;
+    for (long i = 0; i < p_cnt; i++) {
+        CheckpointPhil phil;
+        memcpy(&phil, cursor, sizeof(phil));
+        cursor += sizeof(phil);
+        sessions[i] = static_cast<int>(phil.session);
+        rand_seeds[i] = phil.seed;
+        rest_time[i] = phil.rest;
+        dineState[i] = static_cast<Dine>(phil.dine);
+        drinkState[i] = static_cast<Drink>(phil.drink);
+        resting[i] = phil.resting;
+        signals[i].sched = static_cast<Sched>(phil.sched);
+        finished_cnt += sessions[i] >= count_session;
+        resumed_sessions += sessions[i];
+        drinking_cnt += drinkState[i] == Drink::DRINKING;
+        drinking_since[i] = clock_now();
+        if (measure) {
+            thirsty_since[i] = clock_now();
+        }
+    }
+    drinking_max = drinking_cnt.load();
+    for (unsigned long r = 0; r < header.edge_cnt; r++) {
+        uint16_t flags;
+        memcpy(&flags, cursor, sizeof(flags));
+        cursor += sizeof(flags);
+
+        // Restore both engines' views; the atomic one is exact as its checkpoints never have items in flight
+        Resource &resource = graph.arena[r];
+        for (int s = 0; s < 2; s++) {
+            resource.fork.hold[s] = (flags & (CHECKPOINT_FORK << s)) != 0;
+            resource.fork.reqf[s] = (flags & (CHECKPOINT_FORK_TOKEN << s)) != 0;
+            resource.fork.dirty[s] = (flags & (CHECKPOINT_DIRTY << s)) != 0;
+            resource.bottle.hold[s] = (flags & (CHECKPOINT_BOTTLE << s)) != 0;
+            resource.bottle.reqb[s] = (flags & (CHECKPOINT_BOTTLE_TOKEN << s)) != 0;
+        }
+        resource.fork.word = (resource.fork.hold[1] ? FORK_AT : 0) | (resource.fork.reqf[1] ? FORK_TOKEN : 0) |
+                             (resource.fork.dirty[resource.fork.hold[1] ? 1 : 0] ? FORK_DIRTY : 0) |
+                             (resource.bottle.hold[1] ? BOTTLE_AT : 0) | (resource.bottle.reqb[1] ? BOTTLE_TOKEN : 0);
+    }
+    for (unsigned long e = 0; e < slots; e++) {
+        wanted[e] = (cursor[e / 8] >> (e % 8)) & 1;
+    }
+    cursor += (slots + 7) / 8;
+
+    // A discrete-event run continues with the events that were queued, in the same order
+    if (simulating) {
+        sim_seq = header.sim_seq;
+        sim_events = decltype(sim_events)();
+        sim_current.clear();
+        sim_flight.clear();
+        for (uint64_t i = 0; i < header.event_cnt; i++) {
+            SimEvent event;
+            memcpy(&event, cursor, sizeof(event));
+            cursor += sizeof(event);
+            sim_push(event);
+        }
+        sim_restored = true;
+    }
+    std::cerr << "CHECKPOINT: resumed from " << file << " with " << finished_cnt.load() << "/" << p_cnt << " finished" << std::endl;
+}
+
+// Function to stop every philosopher at the end of its current step; until pause_release the caller may read
+// and replace any state the steps use
+void pause_all() {
+    pause_requested = true;
+    for (long i = 0; i < p_cnt; i++) {
+        while (signals[i].stepping.load()) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+// Function to let the philosophers stopped by pause_all continue
+void pause_release() {
+    {
+        std::lock_guard<std::mutex> lk(pause_lock);
+        pause_requested = false;
+    }
+    pause_condition.notify_all();
+}
+
+// Function to take a step unless a pause is in progress, which the philosopher waits out first; the flag
+// it raises meanwhile is all a step costs when checkpoints or graph updates are enabled
+Step pause_step(long id) {
+    if (!pausing) {
+        return philosopher_step(id);
+    }
+    while (true) {
+        signals[id].stepping = true;
+        if (!pause_requested.load()) {
+            break;
+        }
+        signals[id].stepping = false;
+        std::unique_lock<std::mutex> lk(pause_lock);
+        pause_condition.wait(lk, [] { return !pause_requested.load(); });
+    }
+    Step step = philosopher_step(id);
+    signals[id].stepping = false;
+    return step;
+}
+
+// Function to lock a resource mutex, counting acquisitions and contention when instrumented; a discrete-event
+// run has a single thread and takes no locks
+void resource_lock(std::mutex &lock, long id, long edge) {
+    if (simulating) {
+        return;
+    }
+    if constexpr (PHILO_STATS) {
+        bool contended = !lock.try_lock();
+        if (contended) {
+            lock.lock();
+        }
+        PhilStats &st = phil_stats[id];
+        stats_count(st.lock_acquired);
+        edge_stats[edge].lock_acquired.fetch_add(1, std::memory_order_relaxed);
+        if (contended) {
+            stats_count(st.lock_contended);
+            edge_stats[edge].lock_contended.fetch_add(1, std::memory_order_relaxed);
+        }
+    } else {
+        lock.lock();
+    }
+}
+
+// Function to unlock a resource mutex taken with resource_lock
+void resource_unlock(std::mutex &lock) {
+    if (!simulating) {
+        lock.unlock();
+    }
+}
+
+// Function to put a resource back in its initial state, fork and bottle on side 0 and both request tokens on side 1
+void resource_reset(Resource &resource) {
+    for (int s = 0; s < 2; s++) {
+        resource.fork.hold[s] = s == 0;
+        resource.fork.reqf[s] = s == 1;
+        resource.fork.dirty[s] = true;
+        resource.bottle.hold[s] = s == 0;
+        resource.bottle.reqb[s] = s == 1;
+    }
+    resource.fork.word = FORK_TOKEN | FORK_DIRTY | BOTTLE_TOKEN;
+}
+
+// Function to copy the state of a resource, which must not be in use, into another
+void resource_copy(Resource &to, const Resource &from) {
+    for (int s = 0; s < 2; s++) {
+        to.fork.hold[s] = from.fork.hold[s];
+        to.fork.reqf[s] = from.fork.reqf[s];
+        to.fork.dirty[s] = from.fork.dirty[s];
+        to.bottle.hold[s] = from.bottle.hold[s];
+        to.bottle.reqb[s] = from.bottle.reqb[s];
+    }
+    to.fork.word = from.fork.word.load();
+}
+
+// Function to count a message sent by a philosopher over one of its edge slots
+void stats_message(long from, long edge, Message type) {
+    stats_count(phil_stats[from].sent[static_cast<int>(type)]);
+    edge_stats[graph.edge[edge]].messages.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Function to count one event of a philosopher: a load and a store are enough on its own thread, but a transport
+// receiver applying a message on its behalf runs alongside that thread and needs an atomic add
+void stats_count(std::atomic<uint64_t> &counter) {
+    if (transport_delivering) {
+        counter.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+// Function to start timing an interval on the steady clock, so an adjusted wall time cannot make one negative
+void stats_start(uint64_t &since) {
+    static_assert(Clock::is_steady, "instrumentation intervals need a monotonic clock");
+    // Zero marks a stopped timer, so an interval starting at virtual time zero starts a nanosecond late, and one
+    // stopped at time zero too is empty
+    since = std::max<uint64_t>(1, static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(clock_now().time_since_epoch()).count()));
+}
+
+// Function to stop timing an interval, adding it to a total and a log2-microsecond histogram
+void stats_stop(uint64_t &since, std::atomic<uint64_t> &total, std::atomic<uint64_t> *hist) {
+    if (!since) {
+        return;
+    }
+    uint64_t now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_now().time_since_epoch()).count());
+    uint64_t elapsed = now > since ? now - since : 0;
+    since = 0;
+    total.store(total.load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+    if (hist) {
+        int bucket = 0;
+        for (uint64_t us = elapsed / 1000; us > 1 && bucket < HIST_BUCKETS - 1; us >>= 1) {
+            bucket++;
+        }
+        hist[bucket].store(hist[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+// Function to print a one-line snapshot of the instrumentation totals
+void stats_sample(std::ostream &out, double seconds) {
+    uint64_t steps = 0, spurious = 0, wakeups = 0, acquired = 0, contended = 0, sent[MESSAGE_KINDS] = {};
+    long done = 0;
+    for (long i = 0; i < p_cnt; i++) {
+        PhilStats &st = phil_stats[i];
+        steps += st.steps.load(std::memory_order_relaxed);
+        spurious += st.spurious.load(std::memory_order_relaxed);
+        wakeups += st.wakeups.load(std::memory_order_relaxed);
+        acquired += st.lock_acquired.load(std::memory_order_relaxed);
+        contended += st.lock_contended.load(std::memory_order_relaxed);
+        for (int k = 0; k < MESSAGE_KINDS; k++) {
+            sent[k] += st.sent[k].load(std::memory_order_relaxed);
+        }
+    }
+    done = finished_cnt.load();
+    out << "STATS: t=" << seconds << "s finished=" << done << "/" << p_cnt << " steps=" << steps << " spurious=" << spurious
+        << " wakeups=" << wakeups << " locks=" << acquired << " contended=" << contended << " fork_requests=" << sent[0] << " forks=" << sent[1]
+        << " bottle_requests=" << sent[2] << " bottles=" << sent[3] << std::endl;
+}
+
+// Function representing the thread that periodically samples the instrumentation
+void *stats_sampler(void *) {
+    Clock::time_point next = Clock::now();
+    while (finished_cnt.load() < p_cnt) {
+        // Sleep in short slices so the sampler exits promptly once the run completes
+        next += std::chrono::milliseconds(stats_interval);
+        while (Clock::now() < next && finished_cnt.load() < p_cnt) {
+            std::this_thread::sleep_for(std::min<Clock::duration>(next - Clock::now(), std::chrono::milliseconds(10)));
+        }
+        if (finished_cnt.load() < p_cnt) {
+            stats_sample(std::cerr, std::chrono::duration<double>(Clock::now() - run_start).count());
+        }
+    }
+    return nullptr;
+}
+
+// Function to dump the instrumentation at the end of a run: totals, histograms and the most contended
+// edges to stderr, and one CSV line per philosopher to the stats file when one was given
+void stats_report() {
+    double seconds = std::chrono::duration<double>(clock_now() - run_start).count();
+    stats_sample(std::cerr, seconds);
+
+    // Time breakdown and aggregated histograms
+    double thirsty = 0, hungry = 0, parked = 0, rest = 0;
+    uint64_t thirsty_hist[HIST_BUCKETS] = {}, hungry_hist[HIST_BUCKETS] = {};
+    for (long i = 0; i < p_cnt; i++) {
+        PhilStats &st = phil_stats[i];
+        thirsty += static_cast<double>(st.thirsty_ns.load()) / 1e9;
+        hungry += static_cast<double>(st.hungry_ns.load()) / 1e9;
+        parked += static_cast<double>(st.parked_ns.load()) / 1e9;
+        rest += static_cast<double>(st.resting_ns.load()) / 1e9;
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+            thirsty_hist[b] += st.thirsty_hist[b].load();
+            hungry_hist[b] += st.hungry_hist[b].load();
+        }
+    }
+    std::cerr << "STATS: philosopher-seconds thirsty=" << thirsty << " hungry=" << hungry << " parked=" << parked
+              << " resting=" << rest << std::endl;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        if (thirsty_hist[b] || hungry_hist[b]) {
+            std::cerr << "STATS: wait <" << (1ul << (b + 1)) << "us thirsty=" << thirsty_hist[b] << " hungry=" << hungry_hist[b]
+                      << std::endl;
+        }
+    }
+
+    // Most contended edges
+    std::vector<long> order(graph.arena.size());
+    for (unsigned long i = 0; i < order.size(); i++) {
+        order[i] = static_cast<long>(i);
+    }
+    long top = std::min<long>(10, static_cast<long>(order.size()));
+    std::partial_sort(order.begin(), order.begin() + top, order.end(), [](long a, long b) {
+        return edge_stats[a].lock_contended.load() > edge_stats[b].lock_contended.load();
+    });
+    for (long i = 0; i < top; i++) {
+        EdgeStats &st = edge_stats[order[i]];
+        std::cerr << "STATS: edge " << order[i] << " contended=" << st.lock_contended.load() << " locks=" << st.lock_acquired.load()
+                  << " messages=" << st.messages.load() << std::endl;
+    }
+
+    // Per-philosopher detail
+    if (stats_path.length()) {
+        std::ofstream out(stats_path);
+        out << "philosopher,steps,spurious,thirsty_ns,hungry_ns,parked_ns,resting_ns,locks,contended,"
+               "fork_requests,forks,bottle_requests,bottles,wakeups" << std::endl;
+        for (long i = 0; i < p_cnt; i++) {
+            PhilStats &st = phil_stats[i];
+            out << place_original(i) + 1 << "," << st.steps.load() << "," << st.spurious.load() << "," << st.thirsty_ns.load() << ","
+                << st.hungry_ns.load() << "," << st.parked_ns.load() << "," << st.resting_ns.load() << ","
+                << st.lock_acquired.load() << "," << st.lock_contended.load();
+            for (int k = 0; k < MESSAGE_KINDS; k++) {
+                out << "," << st.sent[k].load();
+            }
+            out << "," << st.wakeups.load() << std::endl;
+        }
+    }
+}
+
+// Function to write a snapshot of the run in the Prometheus text format. Nothing here takes a resource lock: the
+// counters and states are relaxed loads of what the philosophers last wrote, and only a graph update, which swaps
+// the edge counters under layout_lock, is waited for
+void metrics_write(std::ostream &out, long sessions_done, double rate) {
+    long dine[4] = {}, drink[4] = {}, running = 0, done = 0;
+    for (long i = 0; i < p_cnt; i++) {
+        if ((transport == Transport::SOCKET && owner[i] != partition) || (dynamic && !present[i])) {
+            continue;
+        }
+        dine[static_cast<int>(dineState[i].load())]++;
+        drink[static_cast<int>(drinkState[i].load())]++;
+        running++;
+        done += sessions[i] >= count_session;
+    }
+    out << "# HELP philosophers_running Philosophers in the graph\n"
+           "# TYPE philosophers_running gauge\n"
+           "philosophers_running " << running << "\n"
+           "# HELP philosophers_finished Philosophers done with their sessions\n"
+           "# TYPE philosophers_finished gauge\n"
+           "philosophers_finished " << done << "\n"
+           "# HELP philosophers_sessions_total Drinking sessions completed\n"
+           "# TYPE philosophers_sessions_total counter\n"
+           "philosophers_sessions_total " << sessions_done << "\n"
+           "# HELP philosophers_sessions_per_second Drinking sessions completed over the last second\n"
+           "# TYPE philosophers_sessions_per_second gauge\n"
+           "philosophers_sessions_per_second " << rate << "\n"
+           "# HELP philosophers_dine Philosophers in each dining state\n"
+           "# TYPE philosophers_dine gauge\n"
+           "philosophers_dine{state=\"thinking\"} " << dine[static_cast<int>(Dine::THINKING)] << "\n"
+           "philosophers_dine{state=\"hungry\"} " << dine[static_cast<int>(Dine::HUNGRY)] << "\n"
+           "philosophers_dine{state=\"eating\"} " << dine[static_cast<int>(Dine::EATING)] << "\n"
+           "# HELP philosophers_drink Philosophers in each drinking state\n"
+           "# TYPE philosophers_drink gauge\n"
+           "philosophers_drink{state=\"tranquil\"} " << drink[static_cast<int>(Drink::TRANQUIL)] << "\n"
+           "philosophers_drink{state=\"thirsty\"} " << drink[static_cast<int>(Drink::THIRSTY)] << "\n"
+           "philosophers_drink{state=\"drinking\"} " << drink[static_cast<int>(Drink::DRINKING)] << "\n";
+
+    // Most contended edges, by the lock acquisitions that had to wait
+    if constexpr (PHILO_STATS) {
+        std::lock_guard<std::mutex> scraping(layout_lock);
+        std::vector<long> order(graph.arena.size());
+        std::vector<uint64_t> contended(graph.arena.size());
+        for (unsigned long r = 0; r < order.size(); r++) {
+            order[r] = static_cast<long>(r);
+            contended[r] = edge_stats[r].lock_contended.load(std::memory_order_relaxed);
+        }
+        long top = std::min<long>(metrics_top, static_cast<long>(order.size()));
+        std::partial_sort(order.begin(), order.begin() + top, order.end(), [&contended](long a, long b) {
+            return contended[a] > contended[b];
+        });
+        out << "# HELP philosophers_edge_contended_total Fork and bottle lock acquisitions that waited, on the most contended edges\n"
+               "# TYPE philosophers_edge_contended_total counter\n";
+        for (long i = 0; i < top; i++) {
+            out << "philosophers_edge_contended_total{edge=\"" << order[i] << "\"} " << contended[order[i]] << "\n";
+        }
+    } else {
+        out << "# philosophers_edge_contended_total needs a build with -DPHILO_STATS=1\n";
+    }
+}
+
+// Function representing the thread that serves the metrics on a Unix socket: every connection gets one snapshot
+// and is closed, behind an HTTP header when it asked with a GET. Sessions are sampled every 100ms to rate the
+// last second
+void *metrics_server(void *) {
+    // Partitions in their own processes serve their own philosophers, on the path suffixed with the partition
+    std::string socket_path = metrics_path + (transport == Transport::SOCKET && partition > 0 ? "." + std::to_string(partition) : "");
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+    unlink(socket_path.c_str());
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(fd, 16) < 0) {
+        std::cerr << "WARN: cannot serve metrics on " << socket_path << ": " << strerror(errno) << std::endl;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return nullptr;
+    }
+
+    std::deque<std::pair<Clock::time_point, long>> samples;
+    Clock::time_point next = Clock::now();
+    while (finished_cnt.load() < p_cnt) {
+        // Sample the completed sessions, keeping just over a second of samples
+        Clock::time_point now = Clock::now();
+        if (now >= next) {
+            long done = -resumed_sessions;
+            for (long i = 0; i < p_cnt; i++) {
+                done += transport != Transport::SOCKET || owner[i] == partition ? sessions[i].load() : 0;
+            }
+            samples.emplace_back(now, done);
+            while (samples.size() > 2 && now - samples[1].first >= std::chrono::seconds(1)) {
+                samples.pop_front();
+            }
+            next = now + std::chrono::milliseconds(100);
+        }
+
+        // Wait for a scraper in short slices so the server exits promptly once the run completes
+        pollfd ready = {fd, POLLIN, 0};
+        if (poll(&ready, 1, 10) <= 0) {
+            continue;
+        }
+        int client = accept(fd, nullptr, nullptr);
+        if (client < 0) {
+            continue;
+        }
+
+        // Give the scraper a moment to send its request, so an HTTP client gets a status line
+        char request[4] = {};
+        pollfd asked = {client, POLLIN, 0};
+        bool http = poll(&asked, 1, 50) > 0 && recv(client, request, sizeof(request), MSG_DONTWAIT) == 4 &&
+                    !memcmp(request, "GET ", 4);
+        double seconds = std::chrono::duration<double>(samples.back().first - samples.front().first).count();
+        double rate = seconds > 0 ? static_cast<double>(samples.back().second - samples.front().second) / seconds : 0;
+        std::ostringstream body;
+        metrics_write(body, samples.back().second, rate);
+        std::string text = body.str();
+        if (http) {
+            text = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(text.size()) +
+                   "\r\n\r\n" + text;
+        }
+        for (size_t done = 0; done < text.size();) {
+            ssize_t n = send(client, text.data() + done, text.size() - done, MSG_NOSIGNAL);
+            if (n <= 0) {
+                break;
+            }
+            done += static_cast<size_t>(n);
+        }
+        close(client);
+    }
+    close(fd);
+    unlink(socket_path.c_str());
+    return nullptr;
+}
+
+// Function to decide whether a philosopher's step is checked; the gaps between checked steps are drawn from a
+// geometric distribution, so every step is checked with probability verify_rate for one decrement per step
+bool verify_sample(long id) {
+    VerifyPhil &v = verify_phils[id];
+    v.steps++;
+    if (v.skip > 0) {
+        v.skip--;
+        return false;
+    }
+    if (verify_rate < 1) {
+        uint64_t x = v.rng;
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        v.rng = x;
+        double u = static_cast<double>((x * 0x2545F4914F6CDD1Dull) >> 11) * 0x1.0p-53;
+        v.skip = static_cast<uint64_t>(std::log1p(-u) / std::log1p(-verify_rate));
+    }
+    v.checks++;
+    return true;
+}
+
+// Function to check the invariants a philosopher can see on its edges: every fork, bottle and request token is
+// at one end at most (at neither while its message is in flight), a clean fork is only held by a hungry
+// philosopher, and a drinking one still holds every bottle of its session
+void verify_step(long id) {
+    for (long e = graph.offsets[id]; e < graph.offsets[id + 1]; e++) {
+        long r = graph.edge[e];
+        int s = graph.side[e];
+        Resource &resource = graph.arena[r];
+        if (engine == Engine::MUTEX) {
+            resource_lock(resource.fork.lock, id, r);
+            resource_lock(resource.bottle.lock, id, r);
+        }
+        unsigned flags = checkpoint_edge(r);
+        if (engine == Engine::MUTEX) {
+            resource_unlock(resource.bottle.lock);
+            resource_unlock(resource.fork.lock);
+        }
+        if ((flags & CHECKPOINT_FORK) && (flags & CHECKPOINT_FORK << 1)) {
+            verify_fail(id, e, "fork held at both ends");
+        }
+        if ((flags & CHECKPOINT_FORK_TOKEN) && (flags & CHECKPOINT_FORK_TOKEN << 1)) {
+            verify_fail(id, e, "fork request token at both ends");
+        }
+        if ((flags & CHECKPOINT_BOTTLE) && (flags & CHECKPOINT_BOTTLE << 1)) {
+            verify_fail(id, e, "bottle held at both ends");
+        }
+        if ((flags & CHECKPOINT_BOTTLE_TOKEN) && (flags & CHECKPOINT_BOTTLE_TOKEN << 1)) {
+            verify_fail(id, e, "bottle request token at both ends");
+        }
+        if ((flags & CHECKPOINT_FORK << s) && !(flags & CHECKPOINT_DIRTY << s) && dineState[id] != Dine::HUNGRY) {
+            verify_fail(id, e, "clean fork held by a philosopher that is not hungry");
+        }
+        if (drinkState[id] == Drink::DRINKING && wanted[e] && !(flags & CHECKPOINT_BOTTLE << s)) {
+            verify_fail(id, e, "bottle lost while drinking");
+        }
+    }
+}
+
+// Function to add a record to a philosopher's verification history, overwriting the oldest
+void verify_record(long id, Verify kind, long neighbor) {
+    VerifyPhil &v = verify_phils[id];
+    v.history[v.next++ % VERIFY_HISTORY] = VerifyRecord{static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(clock_now() - run_start).count()), neighbor, kind};
+}
+
+// Function to record a message sent by a philosopher over one of its edge slots in its verification history
+void verify_message(long from, long edge, Message type) {
+    verify_record(from, static_cast<Verify>(static_cast<int>(Verify::FORK_REQUEST) + static_cast<int>(type)), graph.neighbor[edge]);
+}
+
+// Function to claim the bottles of a session that starts drinking: every edge records who drinks from its
+// bottle, so two neighbors drinking from the same one at once are caught whichever engine moved it
+void verify_claim(long id) {
+    for (long e = graph.offsets[id]; e < graph.offsets[id + 1]; e++) {
+        long none = -1;
+        if (wanted[e] && !verify_claims[graph.edge[e]].compare_exchange_strong(none, id)) {
+            verify_fail(id, e, "bottle shared with a drinking neighbor");
+        }
+    }
+    verify_phils[id].claims++;
+}
+
+// Function to release the bottles claimed by a session that stops drinking
+void verify_unclaim(long id) {
+    for (long e = graph.offsets[id]; e < graph.offsets[id + 1]; e++) {
+        if (wanted[e] && verify_claims[graph.edge[e]].exchange(-1) != id) {
+            verify_fail(id, e, "bottle claim lost while drinking");
+        }
+    }
+}
+
+// Function to look for a philosopher that has been thirsty for longer than the starvation bound
+void verify_watch() {
+    uint64_t now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_now() - run_start).count()) + 1;
+    for (long i = 0; i < p_cnt; i++) {
+        uint64_t since = verify_phils[i].thirsty_at.load(std::memory_order_relaxed);
+        if (since && now > since && now - since > static_cast<uint64_t>(verify_starve) * 1000000) {
+            verify_fail(i, -1, "thirsty for " + std::to_string((now - since) / 1000000) + "ms");
+        }
+    }
+}
+
+// Function to report a protocol violation and stop the run: the edge it was found on, both ends' states and their
+// latest history. A starving philosopher is reported on the first edge holding it up, followed by the chain of
+// philosophers each waiting on the next, up to one waiting on nobody (a lost wakeup) or a cycle (a deadlock).
+// The other philosophers keep running meanwhile, so their side is as last written
+void verify_fail(long id, long edge, const std::string &what) {
+    // The lock is never released, and graph_update holds it while it publishes a new layout
+    verify_lock.lock();
+    static const char *dine_names[] = {"", "THINKING", "HUNGRY", "EATING"};
+    static const char *drink_names[] = {"", "TRANQUIL", "THIRSTY", "DRINKING"};
+    static const char *kind_names[] = {"", "HUNGRY", "EATING", "THINKING", "THIRSTY", "DRINKING", "DRANK",
+                                       "FORK_REQUEST to", "FORK to", "BOTTLE_REQUEST to", "BOTTLE to"};
+    auto blocking = [](long p) {
+        for (long e = graph.offsets[p]; e < graph.offsets[p + 1]; e++) {
+            unsigned flags = checkpoint_edge(graph.edge[e]);
+            int s = graph.side[e];
+            if ((drinkState[p] == Drink::THIRSTY && wanted[e] && !(flags & CHECKPOINT_BOTTLE << s)) ||
+                (dineState[p] == Dine::HUNGRY && !(flags & CHECKPOINT_FORK << s))) {
+                return e;
+            }
+        }
+        return -1L;
+    };
+    std::vector<long> chain{id};
+    if (edge < 0) {
+        edge = blocking(id);
+        for (long e = edge; e >= 0; e = blocking(chain.back())) {
+            bool cycle = std::find(chain.begin(), chain.end(), graph.neighbor[e]) != chain.end();
+            chain.push_back(graph.neighbor[e]);
+            if (cycle) {
+                break;
+            }
+        }
+    }
+
+    std::vector<long> ends{id};
+    std::cerr << "VIOLATION: " << what << ", philosopher " << place_original(id) + 1;
+    if (edge >= 0) {
+        ends.push_back(graph.neighbor[edge]);
+        std::cerr << " on edge " << place_original(id) + 1 << " " << place_original(ends[1]) + 1;
+    }
+    std::cerr << " at t=" << static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_now() - run_start).count()) / 1000
+              << "us" << (verify_context.length() ? " (" + verify_context + ")" : "") << std::endl;
+
+    // What each end of the edge holds
+    if (edge >= 0) {
+        unsigned flags = checkpoint_edge(graph.edge[edge]);
+        std::cerr << "  edge:";
+        for (long slot : {edge, graph.reverse[edge]}) {
+            int s = graph.side[slot];
+            std::cerr << " " << place_original(graph.neighbor[graph.reverse[slot]]) + 1 << " holds";
+            if (!(flags & (CHECKPOINT_FORK | CHECKPOINT_FORK_TOKEN | CHECKPOINT_BOTTLE | CHECKPOINT_BOTTLE_TOKEN) << s)) {
+                std::cerr << " nothing";
+            }
+            if (flags & CHECKPOINT_FORK << s) {
+                std::cerr << ((flags & CHECKPOINT_DIRTY << s) ? " dirty" : " clean") << " fork";
+            }
+            if (flags & CHECKPOINT_FORK_TOKEN << s) {
+                std::cerr << " fork-token";
+            }
+            if (flags & CHECKPOINT_BOTTLE << s) {
+                std::cerr << (wanted[slot] ? " wanted" : "") << " bottle";
+            }
+            if (flags & CHECKPOINT_BOTTLE_TOKEN << s) {
+                std::cerr << " bottle-token";
+            }
+            std::cerr << (slot == edge ? ";" : "");
+        }
+        std::cerr << std::endl;
+    }
+    if (chain.size() > 2) {
+        std::cerr << "  waiting on:";
+        for (long p : chain) {
+            std::cerr << " " << place_original(p) + 1;
+        }
+        bool cycle = std::find(chain.begin(), chain.end() - 1, chain.back()) != chain.end() - 1;
+        std::cerr << (cycle ? " (a cycle)" : " (waiting on nobody)") << std::endl;
+        if (!cycle) {
+            ends.push_back(chain.back());
+        }
+    }
 
-                // (D1) A thinking, thirsty philosopher becomes hungry
-                if (drinkState[id] == Drink::THIRSTY) {
-                    dineState[id] = Dine::HUNGRY;
-                }
-                break;
+    // The states and the latest history of both ends, and of the end of the chain, oldest first
+    for (long end : ends) {
+        VerifyPhil &v = verify_phils[end];
+        std::cerr << "  philosopher " << place_original(end) + 1 << ": " << dine_names[static_cast<int>(dineState[end].load())] << " "
+                  << drink_names[static_cast<int>(drinkState[end].load())] << ", " << sessions[end] << " sessions" << std::endl;
+        for (uint64_t k = v.next > VERIFY_HISTORY ? v.next - VERIFY_HISTORY : 0; k < v.next; k++) {
+            const VerifyRecord &record = v.history[k % VERIFY_HISTORY];
+            std::cerr << "    t=" << static_cast<double>(record.time) / 1000 << "us " << kind_names[static_cast<int>(record.kind)];
+            if (record.neighbor >= 0) {
+                std::cerr << " " << place_original(record.neighbor) + 1;
+            }
+            std::cerr << std::endl;
+        }
+    }
 
-            // Case when the philosopher is in HUNGRY state
-            case Dine::HUNGRY:
-                // Iterate through the philosopher's neighbors and handle fork requests
-                for (std::pair<int, Resource*> ref_pair : refs) {
-                    auto to = std::find_if(graph[id].begin(), graph[id].end(), [ref_pair](std::pair<int, Resource*> pair) -> bool {return ref_pair.first == pair.first;});
-                    if (to->second->fork.hold && to->second->fork.dirty && to->second->fork.reqf) {
-                        send_fork(id, ref_pair.first);
-                        to->second->fork.hold  = false;
-                        to->second->fork.dirty = false;
-                    }
-                    // If the fork is not held, wait for a fork request and send a request
-                    if (!to->second->fork.hold) {
-                        while (!to->second->fork.reqf) {
-                            std::unique_lock<std::mutex> lk(to->second->fork.lock);
-                            to->second->fork.condition_req_fork.wait(lk);
-                        }
-                        send_fork_request(id, ref_pair.first);
-                        to->second->fork.reqf = false;
-                    }
-                }
+    // Parked threads would hold up the destructors, as with an interrupted checkpoint
+    fflush(stdout);
+    _exit(-1);
+}
 
-                // Wait for all forks to be held
-                for (std::pair<int, Resource*> ref_pair : refs) {
-                    auto to = std::find_if(graph[id].begin(), graph[id].end(), [ref_pair](std::pair<int, Resource*> pair) -> bool {return ref_pair.first == pair.first;});
-                    if (!to->second->fork.hold && !to->second->fork.reqf) {
-                        std::unique_lock<std::mutex> lk(to->second->fork.lock);
-                        to->second->fork.condition_fork.wait(lk);
-                    }
-                }
+// Function representing the thread that watches a threaded run for starving philosophers
+void *verifier(void *) {
+    Clock::time_point next = Clock::now();
+    while (finished_cnt.load() < p_cnt) {
+        // Sleep in short slices so the watchdog exits promptly once the run completes
+        next += std::chrono::milliseconds(std::min(100L, verify_starve));
+        while (Clock::now() < next && finished_cnt.load() < p_cnt) {
+            std::this_thread::sleep_for(std::min<Clock::duration>(next - Clock::now(), std::chrono::milliseconds(10)));
+        }
+        if (finished_cnt.load() < p_cnt) {
+            verify_watch();
+        }
+    }
+    return nullptr;
+}
 
-                // Transition to EATING state
-                dineState[id] = Dine::EATING;
-                break;
+// Function to run the protocol with every invariant checked on a series of random graphs, drawing the topology,
+// its size and the bottle subsets from one seed; a violation names the options that replay its graph alone
+void verify_graphs(long count) {
+    if (transport != Transport::DIRECT || dynamic || checkpoint_path.length() || resume_path.length()) {
+        std::cerr << "ERROR: random graphs run on their own, drop -P, -C, -K and -U" << std::endl;
+        exit(-1);
+    }
+    verifying = true;
+    measure = true;
+    workload_initialize(workload_spec.length() ? workload_spec : "zero");
+    log_format = LogFormat::NONE;
 
-            // Case when the philosopher is in EATING state
-            case Dine::EATING:
-                // Set the forks as dirty after eating
-                for (std::pair<int, Resource*> ref_pair : refs) {
-                    auto to = std::find_if(graph[id].begin(), graph[id].end(), [ref_pair](std::pair<int, Resource*> pair) -> bool {return ref_pair.first == pair.first;});
-                    to->second->fork.dirty = true; 
-                }
-                // If the philosopher is not THIRSTY, transition to THINKING state
-                if (drinkState[id] != Drink::THIRSTY) {
-                    dineState[id] = Dine::THINKING;
-                }
+    std::mt19937_64 rng(static_cast<uint64_t>(seed >= 0 ? seed : time(nullptr)));
+    auto pick = [&rng](long low, long high) {
+        return low + static_cast<long>(rng() % static_cast<uint64_t>(high - low + 1));
+    };
+    uint64_t steps = 0, checks = 0, claims = 0, total = 0;
+    for (long i = 0; i < count; i++) {
+        std::ostringstream spec, bottles;
+        switch (pick(0, 4)) {
+            case 0:
+                spec << "ring:" << pick(3, 48);
+                break;
+            case 1:
+                spec << "complete:" << pick(2, 12);
+                break;
+            case 2:
+                spec << "grid:" << pick(1, 6) << "x" << pick(2, 8);
                 break;
+            case 3:
+                spec << "er:" << pick(2, 48) << ":" << static_cast<double>(pick(5, 60)) / 100;
+                break;
+            default:
+                spec << "powerlaw:" << pick(2, 48) << ":" << pick(1, 3);
+                break;
+        }
+        if (pick(0, 1)) {
+            bottles << "all";
+        } else {
+            bottles << "random:" << static_cast<double>(pick(10, 100)) / 100;
+        }
+        bottles_initialize(bottles.str());
+        seed = pick(0, 0x7fffffff);
+        verify_context = "-g " + spec.str() + " -D " + bottles.str() + " -W " + (workload_spec.length() ? workload_spec : "zero") +
+                         " -R " + std::to_string(seed);
+
+        graph = graph_generate(spec.str());
+        p_cnt = static_cast<int>(graph.offsets.size() - 1);
+        place();
+        simulate();
+        for (long j = 0; j < p_cnt; j++) {
+            steps += verify_phils[j].steps;
+            checks += verify_phils[j].checks;
+            claims += verify_phils[j].claims;
+            total += static_cast<uint64_t>(sessions[j]);
         }
     }
-    return nullptr;
+    std::cout << "VERIFY: " << count << " graphs, " << total << " sessions, " << checks << " of " << steps << " steps checked, "
+              << claims << " drinking sessions claimed their bottles, no violations" << std::endl;
 }
-// Function to send a fork request from one philosopher to another
-void send_fork_request(long from, long to) {
-    // Find the reverse edge in the graph to access the target philosopher's resource
-    auto it = std::find_if(graph[to].begin(), graph[to].end(), [from](std::pair<int, Resource*> ref_pair) -> bool {
-        return from == ref_pair.first;
-    });
 
-    // Check if the reverse edge exists
-    if (it == graph[to].end()) {
-        std::cerr << "WARN: reverse edge for <" << from << "> not found" << std::endl;
+// Function to record an event in the calling thread's ring without taking any lock
+void log_event(long id, Event type) {
+    if (log_format == LogFormat::NONE) {
         return;
     }
 
-    // Set the fork request flag and notify the target philosopher
-    it->second->fork.reqf = true;
-    it->second->fork.condition_req_fork.notify_one();
+    // Register a ring for this thread on its first event
+    if (!log_ring) {
+        std::lock_guard<std::mutex> lk(log_lock);
+        log_rings.emplace_back(new EventRing);
+        log_ring = log_rings.back().get();
+    }
+
+    // Wait for the writer thread if the ring is full
+    uint64_t head = log_ring->head.load(std::memory_order_relaxed);
+    while (head - log_ring->tail.load(std::memory_order_acquire) == EventRing::SIZE) {
+        std::this_thread::yield();
+    }
+
+    uint64_t time = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_now() - run_start).count());
+    log_ring->records[head % EventRing::SIZE] = EventRecord{time, static_cast<uint32_t>(place_original(id)), static_cast<uint32_t>(sessions[id]), type, {}};
+    log_ring->head.store(head + 1, std::memory_order_release);
 }
 
-// Function to send a fork from one philosopher to another
-void send_fork(long from, long to) {
-    // Find the reverse edge in the graph to access the target philosopher's resource
-    auto it = std::find_if(graph[to].begin(), graph[to].end(), [from](std::pair<int, Resource*> ref_pair) -> bool {
-        return from == ref_pair.first;
-    });
+// Function representing the background thread that drains every ring and formats the records
+void *log_writer(void *) {
+    std::vector<EventRecord> drained;
+    std::vector<EventRing *> rings;
+    if (log_format == LogFormat::BINARY) {
+        fwrite(LOG_MAGIC, sizeof(LOG_MAGIC), 1, stdout);
+    }
 
-    // Check if the reverse edge exists
-    if (it == graph[to].end()) {
-        std::cerr << "WARN: reverse edge for <" << from << "> not found" << std::endl;
-        return;
+    while (true) {
+        bool stop = log_stop.load();
+
+        // Collect whatever every ring holds, including rings registered since the last pass
+        {
+            std::lock_guard<std::mutex> lk(log_lock);
+            for (unsigned long i = rings.size(); i < log_rings.size(); i++) {
+                rings.push_back(log_rings[i].get());
+            }
+        }
+        drained.clear();
+        for (EventRing *ring : rings) {
+            uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            for (; tail < head; tail++) {
+                drained.push_back(ring->records[tail % EventRing::SIZE]);
+            }
+            ring->tail.store(tail, std::memory_order_release);
+        }
+
+        // Emit the batch in timestamp order
+        std::stable_sort(drained.begin(), drained.end(), [](const EventRecord &a, const EventRecord &b) {
+            return a.time < b.time;
+        });
+        for (const EventRecord &record : drained) {
+            if (log_format == LogFormat::BINARY) {
+                fwrite(&record, sizeof(record), 1, stdout);
+            } else if (record.type == Event::DRANK) {
+                printf("philosopher %u drinking\n", record.id + 1);
+            } else if (record.type == Event::THINKING) {
+                printf("Thinking time for philosopher %u\n", record.id + 1);
+            }
+        }
+
+        // Records produced before the stop request have all been drained once it is seen
+        if (stop) {
+            break;
+        }
+        if (drained.empty()) {
+            fflush(stdout);
+            usleep(1000);
+        }
+    }
+    fflush(stdout);
+    return nullptr;
+}
+
+// Function to pick the tranquil time for a philosopher
+useconds_t tranquil(long id) {
+    return workload_duration(id, false);
+}
+
+// Function to pick the drinking time for a philosopher
+useconds_t drink(long id) {
+    return workload_duration(id, true);
+}
+
+// Function to parse a workload spec: uniform, zero, spin:<us>, exp:<mean_us>, pareto:<scale_us>:<alpha>
+// or trace:<file>, where the file holds one "<philosopher> <tranquil_us> <drinking_us> [<neighbor>...]" line per
+// session and the optional neighbors pick the bottles of that session
+void workload_initialize(const std::string &spec) {
+    std::string kind = spec.substr(0, spec.find(':'));
+    std::string args = spec.find(':') == std::string::npos ? "" : spec.substr(spec.find(':') + 1);
+    char *end;
+    double a = std::strtod(args.c_str(), &end);
+    double b = *end == ':' ? std::strtod(end + 1, nullptr) : 0;
+
+    if (kind == "uniform") {
+        workload = Workload::UNIFORM;
+    } else if (kind == "zero") {
+        workload = Workload::ZERO;
+    } else if (kind == "spin" && a >= 0) {
+        // Calibrate the spin loop against the clock once, then spin by iteration count alone
+        constexpr uint64_t CALIBRATION = 1 << 22;
+        auto begin = Clock::now();
+        spin(CALIBRATION);
+        double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count());
+        workload = Workload::SPIN;
+        workload_mean = a;
+        spin_iterations = static_cast<uint64_t>(a * 1000 * CALIBRATION / std::max(ns, 1.0));
+    } else if (kind == "exp" && a > 0) {
+        workload = Workload::EXPONENTIAL;
+        workload_mean = a;
+    } else if (kind == "pareto" && a > 0 && b > 0) {
+        workload = Workload::PARETO;
+        workload_mean = a;
+        workload_alpha = b;
+    } else if (kind == "trace" && args.length()) {
+        std::ifstream input(args);
+        if (!input) {
+            std::cerr << "ERROR: cannot open workload trace '" << args << "'" << std::endl;
+            exit(-1);
+        }
+        workload = Workload::TRACE;
+        workload_trace.clear();
+        std::string line;
+        while (std::getline(input, line)) {
+            std::istringstream fields(line);
+            long id, t, d, neighbor;
+            if (!(fields >> id >> t >> d)) {
+                continue;
+            }
+            if (id < 1 || t < 0 || d < 0) {
+                std::cerr << "ERROR: invalid workload trace record " << id << " " << t << " " << d << std::endl;
+                exit(-1);
+            }
+            if (workload_trace.size() < static_cast<unsigned long>(id)) {
+                workload_trace.resize(static_cast<unsigned long>(id));
+            }
+            TraceRecord record{static_cast<useconds_t>(t), static_cast<useconds_t>(d), {}};
+            while (fields >> neighbor) {
+                record.bottles.push_back(neighbor - 1);
+            }
+            workload_trace[id - 1].push_back(std::move(record));
+        }
+    } else {
+        std::cerr << "ERROR: unknown workload '" << spec << "'" << std::endl;
+        exit(-1);
+    }
+}
+
+// Function to draw a tranquil or drinking duration for a philosopher from the workload model
+useconds_t workload_duration(long id, bool drinking) {
+    // Uniform variate in (0, 1) from the philosopher's own seed
+    auto uniform = [id]() -> double {
+        return (rand_r(&rand_seeds[id]) + 1.0) / (RAND_MAX + 2.0);
+    };
+
+    switch (workload) {
+        case Workload::UNIFORM:
+            return static_cast<useconds_t>(drinking ? DRINKING_MIN + rand_r(&rand_seeds[id]) % DRINKING_RANGE
+                                                    : TRANQUIL_MIN + rand_r(&rand_seeds[id]) % TRANQUIL_RANGE);
+        case Workload::ZERO:
+            return 0;
+        case Workload::SPIN:
+            // A discrete-event run passes the spin time on the virtual clock instead
+            if (simulating) {
+                return static_cast<useconds_t>(workload_mean);
+            }
+            spin(spin_iterations);
+            return 0;
+        case Workload::EXPONENTIAL:
+            return static_cast<useconds_t>(std::min(-workload_mean * std::log(uniform()), WORKLOAD_MAX));
+        case Workload::PARETO:
+            return static_cast<useconds_t>(std::min(workload_mean / std::pow(uniform(), 1 / workload_alpha), WORKLOAD_MAX));
+        case Workload::TRACE:
+            // Replay the philosopher's records in order, wrapping when the run has more sessions; the trace uses input ids
+            if (static_cast<unsigned long>(place_original(id)) >= workload_trace.size() || workload_trace[place_original(id)].empty()) {
+                return 0;
+            } else {
+                const std::vector<TraceRecord> &records = workload_trace[place_original(id)];
+                const TraceRecord &record = records[sessions[id] % records.size()];
+                return drinking ? record.drinking : record.tranquil;
+            }
     }
+    return 0;
+}
 
-    // Set the fork as not dirty and hold, then notify the target philosopher
-    it->second->fork.dirty = false;
-    it->second->fork.hold = true;
-    it->second->fork.condition_fork.notify_one();
+// Function to busy-spin for a number of loop iterations without touching memory
+void spin(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
 }
 
-// Function to send a bottle request from one philosopher to another
-void send_bottle_request(long from, long to) {
-    // Find the reverse edge in the graph to access the target philosopher's resource
-    auto it = std::find_if(graph[to].begin(), graph[to].end(), [from](std::pair<int, Resource*> ref_pair) -> bool {
-        return from == ref_pair.first;
-    });
+// Function to parse a bottle mode: all, random:<p> or fixed:<file>, where the file holds one
+// "<philosopher> <neighbor>..." line per configured philosopher
+void bottles_initialize(const std::string &spec) {
+    std::string kind = spec.substr(0, spec.find(':'));
+    std::string args = spec.find(':') == std::string::npos ? "" : spec.substr(spec.find(':') + 1);
 
-    // Check if the reverse edge exists
-    if (it == graph[to].end()) {
-        std::cerr << "WARN: reverse edge for <" << from << "> not found" << std::endl;
-        return;
+    if (kind == "all") {
+        bottle_mode = Bottles::ALL;
+    } else if (kind == "random" && std::strtod(args.c_str(), nullptr) > 0 && std::strtod(args.c_str(), nullptr) <= 1) {
+        bottle_mode = Bottles::RANDOM;
+        bottle_p = std::strtod(args.c_str(), nullptr);
+    } else if (kind == "fixed" && args.length()) {
+        std::ifstream input(args);
+        if (!input) {
+            std::cerr << "ERROR: cannot open bottle configuration '" << args << "'" << std::endl;
+            exit(-1);
+        }
+        bottle_mode = Bottles::FIXED;
+        bottle_config.clear();
+        std::string line;
+        while (std::getline(input, line)) {
+            std::istringstream fields(line);
+            long id, neighbor;
+            if (!(fields >> id)) {
+                continue;
+            }
+            std::vector<long> list;
+            while (fields >> neighbor) {
+                list.push_back(neighbor - 1);
+            }
+            bottle_config.emplace_back(id - 1, std::move(list));
+        }
+    } else {
+        std::cerr << "ERROR: unknown bottle mode '" << spec << "'" << std::endl;
+        exit(-1);
     }
+}
 
-    // Lock the bottle resource, set the bottle request flag, notify the target philosopher, and unlock the bottle
-    it->second->bottle.lock.lock();
-    it->second->bottle.reqb = true;
-    it->second->bottle.condition.notify_one();
-    it->second->bottle.lock.unlock();
+// Function to mark the slots of a philosopher whose neighbor is in a 0-based list, which must name neighbors only;
+// the philosopher and the list use input ids. On a dynamic graph, listed philosophers that are not neighbors
+// (yet, or any more) are skipped
+void bottles_resolve(long id, const std::vector<long> &list, char *mask) {
+    if (id < 0 || id >= p_cnt) {
+        std::cerr << "ERROR: invalid bottle list for philosopher " << id + 1 << std::endl;
+        exit(-1);
+    }
+    long first = graph.offsets[place_renamed(id)], last = graph.offsets[place_renamed(id) + 1];
+    std::fill(mask + first, mask + last, false);
+    for (long neighbor : list) {
+        auto slot = neighbor >= 0 && neighbor < p_cnt ?
+                std::find(graph.neighbor.begin() + first, graph.neighbor.begin() + last, place_renamed(neighbor)) :
+                graph.neighbor.begin() + last;
+        if (slot == graph.neighbor.begin() + last && dynamic) {
+            continue;
+        } else if (slot == graph.neighbor.begin() + last) {
+            std::cerr << "ERROR: philosopher " << neighbor + 1 << " is not a neighbor of " << id + 1 << std::endl;
+            exit(-1);
+        }
+        mask[slot - graph.neighbor.begin()] = true;
+    }
 }
 
-// Function to send a bottle from one philosopher to another
-void send_bottle(long from, long to) {
-    // Find the reverse edge in the graph to access the target philosopher's resource
-    auto it = std::find_if(graph[to].begin(), graph[to].end(), [from](std::pair<int, Resource*> ref_pair) -> bool {
-        return from == ref_pair.first;
-    });
+// Function to pick the bottles a philosopher needs for the session it is about to start
+void bottles_choose(long id) {
+    long first = graph.offsets[id], last = graph.offsets[id + 1];
 
-    // Check if the reverse edge exists
-    if (it == graph[to].end()) {
-        std::cerr << "WARN: reverse edge for <" << from << "> not found" << std::endl;
-        return;
+    // A trace record that lists bottles overrides the bottle mode
+    long input = place_original(id);
+    if (workload == Workload::TRACE && static_cast<unsigned long>(input) < workload_trace.size() && !workload_trace[input].empty()) {
+        const TraceRecord &record = workload_trace[input][sessions[id] % workload_trace[input].size()];
+        if (!record.bottles.empty()) {
+            bottles_resolve(input, record.bottles, wanted.data());
+            wanted_cnt += static_cast<uint64_t>(std::count(wanted.begin() + first, wanted.begin() + last, true));
+            return;
+        }
     }
 
-    // Lock the bottle resource, set the bottle as held, and unlock the bottle
-    it->second->bottle.lock.lock();
-    it->second->bottle.hold = true;
-    it->second->bottle.lock.unlock();
+    switch (bottle_mode) {
+        case Bottles::ALL:
+            std::fill(wanted.begin() + first, wanted.begin() + last, true);
+            break;
+        case Bottles::RANDOM:
+            for (long e = first; e < last; e++) {
+                wanted[e] = rand_r(&rand_seeds[id]) < bottle_p * (RAND_MAX + 1.0);
+            }
+            break;
+        case Bottles::FIXED:
+            std::copy(bottle_fixed.begin() + first, bottle_fixed.begin() + last, wanted.begin() + first);
+            break;
+    }
+    wanted_cnt += static_cast<uint64_t>(std::count(wanted.begin() + first, wanted.begin() + last, true));
 }
-// Function to simulate tranquil time for a philosopher
-void tranquil(long id) {
-    // Sleep for a random duration within the tranquil time range
-    usleep(static_cast<useconds_t>(TRANQUIL_MIN + rand_r(&rand_seeds[id]) % TRANQUIL_RANGE));
+
+// Function to run every philosopher on the current graph until all sessions are complete
+void simulate() {
+    // Initialize vectors to track the state of philosophers' dining and drinking
+    dineState.assign(static_cast<unsigned long>(p_cnt), Dine::THINKING);
+    drinkState.assign(static_cast<unsigned long>(p_cnt), Drink::TRANQUIL);
+    sessions.assign(static_cast<unsigned long>(p_cnt), 0);
+    rest_time.assign(static_cast<unsigned long>(p_cnt), 0);
+    resting.assign(static_cast<unsigned long>(p_cnt), false);
+    signals.reset(new Signal[p_cnt]);
+    wanted.assign(graph.neighbor.size(), false);
+    drinking_since.assign(static_cast<unsigned long>(p_cnt), Clock::time_point());
+    drinking_cnt = 0;
+    drinking_max = 0;
+    drinking_ns = 0;
+    wanted_cnt = 0;
+    finished_cnt = 0;
+    queued_cnt = 0;
+    start.open = false;
+    log_stop = false;
+
+    // Resolve the configured bottle subsets and check the ones listed in a workload trace
+    bottle_fixed.assign(graph.neighbor.size(), true);
+    if (bottle_mode == Bottles::FIXED) {
+        for (const std::pair<long, std::vector<long>> &config : bottle_config) {
+            bottles_resolve(config.first, config.second, bottle_fixed.data());
+        }
+    }
+    if (workload == Workload::TRACE) {
+        std::vector<char> scratch(graph.neighbor.size());
+        for (unsigned long i = 0; i < workload_trace.size(); i++) {
+            for (const TraceRecord &record : workload_trace[i]) {
+                if (!record.bottles.empty()) {
+                    bottles_resolve(static_cast<long>(i), record.bottles, scratch.data());
+                }
+            }
+        }
+    }
+
+    // Assign philosophers to partitions in contiguous blocks and reset the transport
+    if (transport != Transport::DIRECT && engine != Engine::MUTEX) {
+        std::cerr << "ERROR: partitions need the mutex engine" << std::endl;
+        exit(-1);
+    }
+    if (simulating && engine != Engine::MUTEX) {
+        std::cerr << "ERROR: the discrete-event engine needs the mutex engine" << std::endl;
+        exit(-1);
+    }
+    if (transport != Transport::DIRECT && (checkpoint_path.length() || resume_path.length())) {
+        std::cerr << "ERROR: checkpoints cannot capture messages between partitions, drop -P" << std::endl;
+        exit(-1);
+    }
+    if (transport != Transport::DIRECT && simulating) {
+        std::cerr << "ERROR: the discrete-event engine runs every partition on one thread, drop -P" << std::endl;
+        exit(-1);
+    }
+    if (dynamic && (transport != Transport::DIRECT || simulating || checkpoint_path.length() || resume_path.length())) {
+        std::cerr << "ERROR: graph updates need a threaded run of one partition without checkpoints" << std::endl;
+        exit(-1);
+    }
+    if (metrics_path.length() && simulating) {
+        std::cerr << "ERROR: metrics are served during a threaded run, drop -Z" << std::endl;
+        exit(-1);
+    }
+    if (verifying && transport != Transport::DIRECT) {
+        std::cerr << "ERROR: verification reads both ends of every edge, drop -P" << std::endl;
+        exit(-1);
+    }
+
+    // Step with the engine compiled for the graph's topology when one matches it slot for slot
+    stepper = philosopher_step_on<CsrTopology>;
+    if (fixed && dynamic) {
+        std::cerr << "ERROR: compiled-in topologies cannot change while running, drop -H" << std::endl;
+        exit(-1);
+    }
+    for (const FixedTopology &topology : FIXED_TOPOLOGIES) {
+        if (fixed && topology.matches()) {
+            stepper = topology.step;
+            break;
+        }
+    }
+    if (fixed && stepper == philosopher_step_on<CsrTopology>) {
+        std::cerr << (measure ? "WARN" : "ERROR") << ": no compiled-in topology matches the graph, available:";
+        for (const FixedTopology &topology : FIXED_TOPOLOGIES) {
+            std::cerr << " " << topology.spec;
+        }
+        std::cerr << std::endl;
+        if (!measure) {
+            exit(-1);
+        }
+    }
+    if (partitions < 1 || partitions > p_cnt) {
+        std::cerr << "ERROR: cannot split " << p_cnt << " philosophers into " << partitions << " partitions" << std::endl;
+        exit(-1);
+    }
+    owner.resize(static_cast<unsigned long>(p_cnt));
+    for (long i = 0; i < p_cnt; i++) {
+        owner[i] = static_cast<int>(i * partitions / p_cnt);
+    }
+    outbox.assign(static_cast<unsigned long>(partitions * partitions), std::vector<Packet>());
+    vclocks.assign(static_cast<unsigned long>(partitions), std::vector<uint64_t>(static_cast<unsigned long>(partitions), 0));
+    lamport.reset(new std::atomic<uint64_t>[partitions]());
+    transport_sent = 0;
+    transport_received = 0;
+    transport_batches = 0;
+    transport_reordered = 0;
+    transport_latency.clear();
+    transport_stop = false;
+
+    // Initialize the instrumentation when it is compiled in
+    if constexpr (PHILO_STATS) {
+        phil_stats.reset(new PhilStats[p_cnt]);
+        edge_stats.reset(new EdgeStats[graph.arena.size()]);
+    }
+
+    // Initialize the latency samples when benchmarking
+    if (measure) {
+        thirsty_since.assign(static_cast<unsigned long>(p_cnt), Clock::time_point());
+        latencies.assign(static_cast<unsigned long>(p_cnt), std::vector<uint64_t>());
+    }
+
+    // Initialize random seeds for philosophers, from the given seed or a fixed one in a discrete-event run
+    rand_seeds.resize(static_cast<unsigned long>(p_cnt));
+    srand(static_cast<unsigned int>(seed >= 0 ? seed : simulating ? 1 : time(nullptr)));
+    for (long i = 0; i < p_cnt; i++) {
+        rand_seeds[i] = static_cast<unsigned int>(rand());
+    }
+
+    // Initialize the verification with free bottles and a sampling stream per philosopher
+    if (verifying) {
+        verify_phils.reset(new VerifyPhil[p_cnt]);
+        verify_claims.reset(new std::atomic<long>[graph.arena.size()]);
+        for (unsigned long r = 0; r < graph.arena.size(); r++) {
+            verify_claims[r] = -1;
+        }
+        for (long i = 0; i < p_cnt; i++) {
+            verify_phils[i].rng = static_cast<uint64_t>(rand_seeds[i]) << 32 | static_cast<uint64_t>(i + 1);
+        }
+    }
+
+    // Philosophers outside a dynamic graph count as finished, and the open control channel as one still running
+    if (dynamic) {
+        meals.assign(static_cast<unsigned long>(p_cnt), 0);
+        finished_cnt = std::count(present.begin(), present.end(), false) - 1;
+    }
+
+    // Continue from a checkpoint, and take checkpoints periodically and on SIGINT or SIGTERM
+    resumed_sessions = 0;
+    if (resume_path.length()) {
+        checkpoint_load(resume_path);
+
+        // Resumed sessions claim their bottles and are watched for starvation from the start of this run
+        for (long i = 0; verifying && i < p_cnt; i++) {
+            if (drinkState[i] == Drink::DRINKING) {
+                verify_claim(i);
+            }
+            verify_phils[i].thirsty_at = drinkState[i] == Drink::THIRSTY;
+        }
+    }
+    if (checkpoint_path.length()) {
+        checkpoint_next = Clock::now() + std::chrono::milliseconds(checkpoint_interval);
+        signal(SIGINT, checkpoint_interrupt);
+        signal(SIGTERM, checkpoint_interrupt);
+    }
+    pausing = (checkpoint_path.length() && !simulating) || dynamic;
+    pause_requested = false;
+
+    // Over sockets, every partition continues in its own process and only runs its own philosophers
+    if (transport == Transport::SOCKET) {
+        transport_fork();
+    }
+    auto local = [](long id) {
+        return transport != Transport::SOCKET || owner[id] == partition;
+    };
+
+    // Initialize either one thread per philosopher or a fixed pool of workers; a discrete-event run steps
+    // every philosopher on this thread instead
+    std::vector<pthread_t> threads;
+    if (!simulating && workers > 0) {
+        threads.resize(static_cast<unsigned long>(workers));
+        pool.reset(new Worker[workers]);
+        if (coroutines) {
+            frames.assign(static_cast<unsigned long>(p_cnt), nullptr);
+            for (long i = 0; i < p_cnt; i++) {
+                if (local(i)) {
+                    frames[i] = philosopher_coroutine(i).handle;
+                }
+            }
+        }
+        for (long i = 0; i < workers; i++) {
+            pthread_create(&threads[i], nullptr, worker, (void *) i);
+        }
+        for (long i = 0; i < p_cnt; i++) {
+            if (local(i)) {
+                signals[i].sched = Sched::QUEUED;
+                schedule(i);
+            }
+        }
+    } else if (!simulating) {
+        for (long i = 0; i < p_cnt; i++) {
+            if (local(i)) {
+                threads.emplace_back();
+                pthread_create(&threads.back(), nullptr, philosopher, (void *) i);
+            }
+        }
+    }
+
+    // Start the transport threads that carry messages between partitions
+    pthread_t sender, receiver;
+    if (transport != Transport::DIRECT) {
+        pthread_create(&sender, nullptr, transport_sender, nullptr);
+    }
+    if (transport == Transport::SOCKET) {
+        pthread_create(&receiver, nullptr, transport_receiver, nullptr);
+    }
+
+    // Start the event log writer and signal the start of simulation
+    run_start = simulating ? Clock::time_point() : Clock::now();
+    if (log_format != LogFormat::NONE) {
+        pthread_create(&log_thread, nullptr, log_writer, nullptr);
+    }
+    pthread_t sampler;
+    if (PHILO_STATS && stats_interval > 0 && !simulating) {
+        pthread_create(&sampler, nullptr, stats_sampler, nullptr);
+    }
+    pthread_t metrics;
+    if (metrics_path.length() && !simulating) {
+        pthread_create(&metrics, nullptr, metrics_server, nullptr);
+    }
+    pthread_t checkpoints;
+    if (checkpoint_path.length() && !simulating) {
+        pthread_create(&checkpoints, nullptr, checkpointer, nullptr);
+    }
+    pthread_t control;
+    if (dynamic) {
+        pthread_create(&control, nullptr, control_reader, nullptr);
+    }
+    pthread_t watchdog;
+    if (verifying && !simulating) {
+        pthread_create(&watchdog, nullptr, verifier, nullptr);
+    }
+    gate_open(start);
+    Clock::time_point wall_start = Clock::now(), report_start = clock_now();
+    if (simulating) {
+        sim_run();
+    }
+
+    // Wait for the control channel to close and all philosopher or worker threads to finish, then drain the event log
+    if (dynamic) {
+        pthread_join(control, nullptr);
+    }
+    for (pthread_t thread : threads) {
+        pthread_join(thread, nullptr);
+    }
+    for (std::coroutine_handle<> frame : frames) {
+        if (frame) {
+            frame.destroy();
+        }
+    }
+    frames.clear();
+    if (checkpoint_path.length() && !simulating) {
+        pthread_join(checkpoints, nullptr);
+    }
+    if (verifying && !simulating) {
+        pthread_join(watchdog, nullptr);
+    }
+    if (metrics_path.length() && !simulating) {
+        pthread_join(metrics, nullptr);
+    }
+    if (log_format != LogFormat::NONE) {
+        log_stop = true;
+        pthread_join(log_thread, nullptr);
+    }
+
+    // Flush the outboxes and stop the transport
+    if (transport != Transport::DIRECT) {
+        transport_stop = true;
+        transport_condition.notify_one();
+        pthread_join(sender, nullptr);
+    }
+    if (transport == Transport::SOCKET) {
+        pthread_join(receiver, nullptr);
+    }
+
+    // Dump the instrumentation
+    if (PHILO_STATS && stats_interval > 0 && !simulating) {
+        pthread_join(sampler, nullptr);
+    }
+    if constexpr (PHILO_STATS) {
+        stats_report();
+    }
+
+    // Report the achieved concurrency as the mean and peak number of philosophers drinking at once
+    if (!measure) {
+        double seconds = std::chrono::duration<double>(clock_now() - report_start).count();
+        long total = -resumed_sessions;
+        for (long i = 0; i < p_cnt; i++) {
+            total += local(i) ? sessions[i].load() : 0;
+        }
+        std::cerr << "CONCURRENCY: mean " << static_cast<double>(drinking_ns.load()) / 1e9 / seconds
+                  << " max " << drinking_max.load() << " drinking, "
+                  << static_cast<double>(wanted_cnt.load()) / static_cast<double>(std::max(1L, total))
+                  << " bottles per session" << std::endl;
+        if (transport != Transport::DIRECT) {
+            transport_report(seconds);
+        }
+        if (!simulating && workers <= 0) {
+            uint64_t spun = 0, yielded = 0, slept = 0;
+            long budget = 0;
+            for (long i = 0; i < p_cnt; i++) {
+                if (local(i)) {
+                    spun += signals[i].spun;
+                    yielded += signals[i].yielded;
+                    slept += signals[i].slept;
+                    budget += signals[i].spin_budget;
+                }
+            }
+            double waits = static_cast<double>(std::max<uint64_t>(1, spun + yielded + slept));
+            std::cerr << "WAITS: " << spun + yielded + slept << " waits for a message, "
+                      << 100 * static_cast<double>(spun) / waits << "% ended spinning, "
+                      << 100 * static_cast<double>(yielded) / waits << "% yielding, "
+                      << 100 * static_cast<double>(slept) / waits << "% parked, mean spin budget "
+                      << static_cast<double>(budget) / p_cnt << std::endl;
+        }
+        if (coroutines && !simulating) {
+            rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            std::cerr << "COROUTINES: " << p_cnt << " philosophers on " << workers << " workers, " << frame_pool.size
+                      << "-byte frames, peak RSS " << usage.ru_maxrss * 1024 / p_cnt << " bytes per philosopher" << std::endl;
+        }
+        if (verifying) {
+            uint64_t steps = 0, checks = 0, claims = 0;
+            for (long i = 0; i < p_cnt; i++) {
+                steps += verify_phils[i].steps;
+                checks += verify_phils[i].checks;
+                claims += verify_phils[i].claims;
+            }
+            std::cerr << "VERIFY: " << checks << " of " << steps << " steps checked, " << claims
+                      << " drinking sessions claimed their bottles, no violations" << std::endl;
+        }
+        if (simulating) {
+            std::cerr << "SIMULATION: " << sim_count << " events, " << seconds << "s virtual in "
+                      << std::chrono::duration<double>(Clock::now() - wall_start).count() << "s" << std::endl;
+        }
+    }
+
+    // Child partitions end here, the parent waits for them
+    if (transport == Transport::SOCKET) {
+        if (partition != 0) {
+            exit(0);
+        }
+        for (pid_t child : children) {
+            waitpid(child, nullptr, 0);
+        }
+        for (int fd : peer_fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
 }
 
-// Function to simulate drinking time for a philosopher
-void drink(long id) {
-    // Sleep for a random duration within the drinking time range
-    usleep(static_cast<useconds_t>(DRINKING_MIN + rand_r(&rand_seeds[id]) % DRINKING_RANGE));
+// Function to benchmark the protocol on synthetic topologies and report throughput, latency and fairness
+void bench(const std::string &specs) {
+    // Benchmarks measure the protocol itself: no sleeping unless a workload is given, and no event output
+    if (transport == Transport::SOCKET) {
+        std::cerr << "ERROR: the socket transport cannot be benchmarked, use -T queue" << std::endl;
+        exit(-1);
+    }
+    if (checkpoint_path.length() || resume_path.length()) {
+        std::cerr << "ERROR: benchmarks do not take or resume checkpoints" << std::endl;
+        exit(-1);
+    }
+    if (dynamic) {
+        std::cerr << "ERROR: benchmarks run fixed graphs, drop -C" << std::endl;
+        exit(-1);
+    }
+    measure = true;
+    workload_initialize(workload_spec.length() ? workload_spec : "zero");
+    log_format = LogFormat::NONE;
+
+    bool json = bench_format == "json";
+    if (json) {
+        std::cout << "[" << std::endl;
+    } else {
+        std::cout << "topology,nodes,edges,sessions,workers,engine,placement,batch,coroutines,fixed,workload,seconds,sessions_per_sec,"
+                     "p50_us,p99_us,p999_us,fairness,concurrency" << std::endl;
+    }
+
+    std::stringstream list(specs);
+    std::string spec;
+    bool first = true;
+    while (std::getline(list, spec, ',')) {
+        graph = graph_generate(spec);
+        p_cnt = static_cast<int>(graph.offsets.size() - 1);
+        place();
+
+        auto begin = Clock::now();
+        simulate();
+        double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+        // A discrete-event run is rated against the virtual time it covered, when any passed
+        if (simulating && sim_now > 0) {
+            seconds = static_cast<double>(sim_now) / 1e9;
+        }
+
+        // Latency percentiles over every session, fairness as Jain's index of per-philosopher mean latency
+        std::vector<uint64_t> all;
+        double sum = 0, sum_sq = 0;
+        for (const std::vector<uint64_t> &samples : latencies) {
+            double mean = 0;
+            for (uint64_t sample : samples) {
+                all.push_back(sample);
+                mean += static_cast<double>(sample);
+            }
+            mean /= samples.empty() ? 1 : static_cast<double>(samples.size());
+            sum += mean;
+            sum_sq += mean * mean;
+        }
+        std::sort(all.begin(), all.end());
+        auto percentile = [&all](double q) -> double {
+            return all.empty() ? 0 : static_cast<double>(all[static_cast<unsigned long>(q * static_cast<double>(all.size() - 1))]) / 1000;
+        };
+        double fairness = sum_sq > 0 ? sum * sum / (p_cnt * sum_sq) : 1;
+        double rate = static_cast<double>(all.size()) / seconds;
+        const char *engine_name = engine == Engine::ATOMIC ? "atomic" : "mutex";
+        const char *placement_name = placement == Placement::LABEL ? "label" : "none";
+        std::string workload_name = workload_spec.length() ? workload_spec : "zero";
+        double concurrency = static_cast<double>(drinking_ns.load()) / 1e9 / seconds;
+        bool specialized = stepper != philosopher_step_on<CsrTopology>;
+
+        if (json) {
+            std::cout << (first ? "  " : ",\n  ") << "{\"topology\": \"" << spec << "\", \"nodes\": " << p_cnt
+                      << ", \"edges\": " << graph.arena.size() << ", \"sessions\": " << count_session
+                      << ", \"workers\": " << workers << ", \"engine\": \"" << engine_name << "\", \"placement\": \"" << placement_name << "\", \"batch\": " << (batch ? "true" : "false") << ", \"coroutines\": " << (coroutines ? "true" : "false") << ", \"fixed\": " << (specialized ? "true" : "false") << ", \"workload\": \"" << workload_name
+                      << "\", \"seconds\": " << seconds
+                      << ", \"sessions_per_sec\": " << rate << ", \"p50_us\": " << percentile(0.5)
+                      << ", \"p99_us\": " << percentile(0.99) << ", \"p999_us\": " << percentile(0.999)
+                      << ", \"fairness\": " << fairness << ", \"concurrency\": " << concurrency << "}";
+        } else {
+            std::cout << spec << "," << p_cnt << "," << graph.arena.size() << "," << count_session << "," << workers << ","
+                      << engine_name << "," << placement_name << "," << batch << "," << coroutines << "," << specialized << "," << workload_name << "," << seconds << "," << rate << "," << percentile(0.5) << ","
+                      << percentile(0.99) << "," << percentile(0.999) << "," << fairness << ","
+                      << concurrency << std::endl;
+        }
+        first = false;
+    }
+    if (json) {
+        std::cout << (first ? "]" : "\n]") << std::endl;
+    }
 }
 
 int main(int argc, char **argv) {
     // Initialize the dining graph based on command line arguments
-    graph = graph_initialize(parser(argc, argv));
+    int mode = parser(argc, argv);
+    if (bench_lookup) {
+        bench_graph();
+        return 0;
+    }
+    if (bench_spec.length()) {
+        bench(bench_spec);
+        return 0;
+    }
+    if (verify_count > 0) {
+        verify_graphs(verify_count);
+        return 0;
+    }
+    workload_initialize(workload_spec.length() ? workload_spec : "uniform");
+    graph = graph_spec.length() ? graph_generate(graph_spec) : graph_initialize(mode);
+    p_cnt = static_cast<int>(graph.offsets.size() - 1);
+
+    // Write the graph in the binary format instead of running it
+    if (convert_path.length()) {
+        graph_save(convert_path);
+        return 0;
+    }
+
+    // Leave room for the philosophers a dynamic graph may add; those beyond the initial graph start outside it
+    int initial = p_cnt;
+    if (dynamic && capacity > p_cnt) {
+        graph.offsets.resize(static_cast<unsigned long>(capacity) + 1, graph.offsets.back());
+        p_cnt = capacity;
+    }
+    if (dynamic && p_cnt == 0) {
+        std::cerr << "ERROR: no philosophers to add edges to, give their number with -N" << std::endl;
+        exit(-1);
+    }
 
     // Debug information display
     if (debug) {
@@ -505,39 +5037,23 @@ int main(int argc, char **argv) {
         getchar();
 
         std::cout << "graph initialization:" << std::endl;
-        for (int i = 0; i < graph.size(); i++) {
+        for (int i = 0; i < p_cnt; i++) {
             std::cout << i << ": ";
-            for (const auto &adjacent : graph[i]) {
-                std::cout << adjacent.first << " (" << adjacent.second << ") ";
+            for (long e = graph.offsets[i]; e < graph.offsets[i + 1]; e++) {
+                std::cout << graph.neighbor[e] << " (" << &graph.arena[graph.edge[e]] << ") ";
             }
             std::cout << std::endl;
         }
         printf("CONFIG: %d philosophers DRINK  %d times.\n\n", p_cnt, count_session);
     }
 
-    // Initialize vectors to track the state of philosophers' dining and drinking
-    dineState.resize(static_cast<unsigned long>(p_cnt), Dine::THINKING);
-    drinkState.resize(static_cast<unsigned long>(p_cnt), Drink::TRANQUIL);
-
-    // Initialize an array of threads for philosophers
-    pthread_t threads[p_cnt];
-
-    // Initialize random seeds and threads for philosophers
-    rand_seeds.resize(static_cast<unsigned long>(p_cnt));
-    srand(static_cast<unsigned int>(time(nullptr)));
-    for (long i = 0; i < p_cnt; i++) {
-        pthread_create(&threads[i], nullptr, philosopher, (void *) i);
-        rand_seeds[i] = static_cast<unsigned int>(rand());
-    }
-
-    // Signal the start of simulation
-    start = true;
-
-    // Wait for all philosopher threads to finish
-    for (int i = 0; i < p_cnt; i++) {
-        pthread_join(threads[i], nullptr);
+    // Place the philosophers on cores and run the simulation on the graph
+    place();
+    present.assign(static_cast<unsigned long>(p_cnt), false);
+    for (int i = 0; i < initial; i++) {
+        present[place_renamed(i)] = true;
     }
+    simulate();
 
     return 0;
 }
-
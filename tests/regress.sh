@@ -0,0 +1,72 @@
+#!/bin/sh
+# Regression runs: builds the plain and instrumented binaries and checks runs that once failed.
+# Usage: tests/regress.sh (from the repository root)
+set -u
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+failures=0
+
+# Function to report one check
+check() {
+    if [ "$2" -eq 0 ]; then
+        echo "PASS: $1"
+    else
+        echo "FAIL: $1"
+        failures=$((failures + 1))
+    fi
+}
+
+g++ -std=c++20 -O2 -pthread main.cpp -o "$dir/philo" || exit 1
+g++ -std=c++20 -O2 -pthread -DPHILO_STATS=1 main.cpp -o "$dir/philo_stats" || exit 1
+
+# The message-cost benchmark sends messages outside a run, which the instrumentation counts
+"$dir/philo_stats" --bench-graph > /dev/null
+check "--bench-graph in an instrumented build" $?
+for flags in "-w 4" "-O" "-M" "-P 2" "-P 2 -T queue" "-T socket" "-V 1" "-X 3"; do
+    "$dir/philo" --bench-graph $flags > /dev/null 2>&1
+    [ $? -eq 255 ]
+    check "--bench-graph rejects $flags" $?
+done
+
+# Placement never cuts more edges than contiguous blocks of the input order
+for run in "16x16 2" "32x32 2" "32x32 4" "32x32 8"; do
+    set -- $run
+    cuts=$("$dir/philo" -g grid:$1 -A label -w $2 -s 10 -W zero -Z 1 -R 1 2>&1 > /dev/null | sed -n 's/.*edge-cut \([0-9]*\) -> \([0-9]*\),.*/\1 \2/p')
+    [ -n "$cuts" ] && [ "${cuts#* }" -le "${cuts% *}" ]
+    check "placement of grid:$1 in $2 groups does not raise the edge-cut ($cuts)" $?
+done
+
+# The verifier finds no violation on random graphs, and the discrete-event engine checks the same ones every time
+"$dir/philo" -X 2000 -Z 1 -R 1 > "$dir/verify.out" 2> /dev/null &&
+    grep -q "^VERIFY: 2000 graphs, .* no violations$" "$dir/verify.out" &&
+    "$dir/philo" -X 2000 -Z 1 -R 1 2> /dev/null | cmp -s - "$dir/verify.out"
+check "simulated verification of 2000 random graphs" $?
+for flags in "" "-e atomic" "-w 2" "-O"; do
+    "$dir/philo" -X 20 -R 1 $flags 2> /dev/null | grep -q "^VERIFY: 20 graphs, .* no violations$"
+    check "threaded verification of 20 random graphs ${flags:-with a thread per philosopher}" $?
+done
+
+# An interrupted run resumed from its checkpoint logs exactly what an uninterrupted run does: the same events in
+# the same order under the discrete-event engine, the same number of them on threads
+"$dir/philo" -g ring:1000 -s 3000 -Z 1 -R 7 > "$dir/full.log" 2> /dev/null
+for delay in 0.3 0.5 0.7; do
+    rm -f "$dir/checkpoint"
+    "$dir/philo" -g ring:1000 -s 3000 -Z 1 -R 7 -K "$dir/checkpoint" -J 100000 > "$dir/first.log" 2> /dev/null &
+    sleep $delay
+    kill -INT $!
+    wait $!
+    "$dir/philo" -g ring:1000 -s 3000 -Z 1 -R 7 -U "$dir/checkpoint" > "$dir/second.log" 2> /dev/null
+    cat "$dir/first.log" "$dir/second.log" | cmp -s - "$dir/full.log"
+    check "simulated log interrupted after ${delay}s and resumed" $?
+done
+rm -f "$dir/checkpoint"
+"$dir/philo" -g ring:50 -s 5000 -W zero -K "$dir/checkpoint" -J 100000 > "$dir/first.log" 2> /dev/null &
+sleep 0.5
+kill -INT $!
+wait $!
+"$dir/philo" -g ring:50 -s 5000 -W zero -U "$dir/checkpoint" > "$dir/second.log" 2> /dev/null
+[ "$(cat "$dir/first.log" "$dir/second.log" | wc -l)" -eq $((50 * 5000 * 2)) ]
+check "threaded log interrupted and resumed" $?
+
+[ "$failures" -eq 0 ]